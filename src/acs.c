@@ -1,6 +1,7 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "acs.h"
 
@@ -18,18 +19,41 @@
 
 #else // UNIX-based
 
-#include <string.h>
 #include <errno.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#include <poll.h>
+
+#ifdef __linux__
+#include <linux/errqueue.h>
+#endif
+
+#if defined(__linux__) && defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY) && defined(SOL_IP) && defined(SOL_IPV6)
+#define HAVE_ZEROCOPY
+#endif
+
+#ifdef ACS_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif // ACS_URING
 
 #endif // _WIN32
 
 static int initialized = 0;
 
+static void *default_malloc(size_t size, void *ctx);
+static void *default_realloc(void *ptr, size_t size, void *ctx);
+static void default_free(void *ptr, void *ctx);
+
+static struct acs_allocator allocator = { default_malloc, default_realloc, default_free, NULL };
+
 struct acs {
 #ifdef _WIN32
     SOCKET fd;
@@ -38,8 +62,95 @@ struct acs {
 #endif
     const char *host;
     const char *port;
+    size_t zerocopy_min;     // sends of this many bytes or more go with MSG_ZEROCOPY, 0 for none
+    int zerocopy_on;         // SO_ZEROCOPY is set on fd
+    uint64_t zerocopy_sent;  // MSG_ZEROCOPY sends ever made
+    uint64_t zerocopy_base;  // zerocopy_sent when fd was dialed, the kernel counts from there
+    uint64_t zerocopy_done;  // of those, how many the kernel let go of
+#ifdef ACS_URING
+    struct acs_ring *ring;  // NULL unless acs_ring_add put us on one
+    size_t ring_slot;
+#endif
 };
 
+struct acs_multicast {
+#ifdef _WIN32
+    SOCKET fd;
+#else
+    int fd;
+#endif
+};
+
+#define MULTICAST_RCVBUF (4 << 20) // a whole snapshot's datagrams queue up between round trips
+
+#ifdef ACS_URING
+
+#define RING_SEND 1
+#define RING_RECV 2
+#define RING_SEQ_MASK 0x3fffffffu // seq as it fits the user_data
+#define RING_GROUP 0              // buffer group of the provided buffers
+
+struct ring_slot {
+    struct acs *sock;
+    void *tag;
+    uint32_t seq;           // bumped when the connection closes, completions for older ones are stale
+    int armed;              // a multishot recv is outstanding for seq
+    int failed;             // closed by an error the next acs_ring_send reports, like acs_send would
+    const char *send_buf;   // send in flight, NULL for none
+    size_t send_size;
+    size_t send_done;
+};
+
+struct acs_ring {
+    int fd;
+
+    // submission and completion queues share one mapping
+    unsigned char *queues;
+    size_t queues_len;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    size_t sqes_len;
+    unsigned sq_local;      // tail including SQEs not published yet
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+
+    // provided buffers the recvs land in, registered with the kernel
+    struct io_uring_buf_ring *buf_ring;
+    size_t buf_ring_len;
+    unsigned char *buffers;
+    unsigned buffer_count;
+    size_t buffer_size;
+    unsigned short buf_tail;
+    int held;               // buffer of the last recv event, -1 for none
+
+    struct ring_slot *slots;
+    size_t slot_count;
+    size_t slot_max;
+};
+
+static struct io_uring_sqe *ring_sqe(struct acs_ring *self, struct ring_slot *slot, unsigned kind); // next SQE to fill for slot
+static void ring_buffer_put(struct acs_ring *self, unsigned id); // hand a buffer back to the kernel
+static void ring_arm(struct acs_ring *self, struct ring_slot *slot); // queue the slot's multishot recv
+static void ring_send_rest(struct acs_ring *self, struct ring_slot *slot); // queue what is left of the slot's send
+static void ring_close(struct acs *sock, int failed); // end the connection and what it has in flight
+
+#endif // ACS_URING
+
+/**
+ * Dial the server of \a self, ready for MSG_ZEROCOPY if asked
+ */
+static enum acs_code acs_connect(struct acs *self);
+
+#ifdef HAVE_ZEROCOPY
+static void zerocopy_reap(struct acs *self); // take the kernel's completions off the error queue
+#endif
+
 /**
  * Dial a server
  */
@@ -52,6 +163,76 @@ static enum acs_code acs_dial(
     const char *host,
     const char *port);
 
+#ifndef _WIN32
+static enum acs_code acs_dial_unix(int *clientfd, const char *path); // dial a Unix domain socket
+#endif
+
+static void *default_malloc(size_t size, void *ctx)
+{
+    (void)ctx;
+    return malloc(size);
+}
+
+static void *default_realloc(void *ptr, size_t size, void *ctx)
+{
+    (void)ctx;
+    return realloc(ptr, size);
+}
+
+static void default_free(void *ptr, void *ctx)
+{
+    (void)ctx;
+    free(ptr);
+}
+
+void acs_set_allocator(const struct acs_allocator *hooks)
+{
+    assert(!initialized);
+
+    if (hooks) {
+        assert(hooks->malloc && hooks->realloc && hooks->free);
+        allocator = *hooks;
+    }
+    else {
+        allocator.malloc = default_malloc;
+        allocator.realloc = default_realloc;
+        allocator.free = default_free;
+        allocator.ctx = NULL;
+    }
+}
+
+void *acs_malloc(size_t size)
+{
+    return allocator.malloc(size, allocator.ctx);
+}
+
+void *acs_calloc(size_t count, size_t size)
+{
+    void *ptr;
+
+    if (size != 0 && count > (size_t)-1 / size) {
+        return NULL;
+    }
+
+    ptr = acs_malloc(count * size);
+    if (ptr) {
+        (void)memset(ptr, 0, count * size);
+    }
+    return ptr;
+}
+
+void *acs_realloc(void *ptr, size_t size)
+{
+    return allocator.realloc(ptr, size, allocator.ctx);
+}
+
+void acs_free(void *ptr)
+{
+    if (ptr) {
+        allocator.free(ptr, allocator.ctx);
+    }
+}
+
 enum acs_code acs_init(void)
 {
     #ifdef _WIN32
@@ -90,7 +271,7 @@ struct acs *acs_new(const char *host, const char *port)
     assert(host);
     assert(port);
 
-    self = malloc(sizeof(*self));
+    self = acs_malloc(sizeof(*self));
     if (!self) {
         return NULL;
     }
@@ -102,6 +283,15 @@ struct acs *acs_new(const char *host, const char *port)
     #endif
     self->host = host;
     self->port = port;
+    self->zerocopy_min = 0;
+    self->zerocopy_on = 0;
+    self->zerocopy_sent = 0;
+    self->zerocopy_base = 0;
+    self->zerocopy_done = 0;
+#ifdef ACS_URING
+    self->ring = NULL;
+    self->ring_slot = 0;
+#endif
 
     return self;
 }
@@ -110,6 +300,9 @@ void acs_del(struct acs *self)
 {
     assert(initialized);
     assert(self);
+#ifdef ACS_URING
+    assert(!self->ring);
+#endif
 
     #ifdef _WIN32
         if (self->fd != INVALID_SOCKET) {
@@ -123,12 +316,13 @@ void acs_del(struct acs *self)
             self->fd = -1;
         }
     #endif
-    free(self);
+    acs_free(self);
 }
 
 enum acs_code acs_send(struct acs *self, char *buf, size_t bytes)
 {
     int rv;
+    int flags = 0;
     long offset = 0;
 
     assert(initialized);
@@ -144,14 +338,30 @@ enum acs_code acs_send(struct acs *self, char *buf, size_t bytes)
         #endif
         )
     {
-        rv = acs_dial(&self->fd, self->host, self->port);
-        if (rv != 0) {
+        if (acs_connect(self) != ACS_OK) {
             return ACS_ERROR;
         }
     }
 
+#ifdef HAVE_ZEROCOPY
+    if (self->zerocopy_on && bytes >= self->zerocopy_min) {
+        flags = MSG_ZEROCOPY;
+    }
+#endif
+
     while (1) {
-        rv = send(self->fd, &buf[offset], bytes - offset, 0);
+        rv = send(self->fd, &buf[offset], bytes - offset, flags);
+
+#ifdef HAVE_ZEROCOPY
+        // out of pinnable memory, copy like any other send
+        if (rv == -1 && flags != 0 && errno == ENOBUFS) {
+            flags = 0;
+            continue;
+        }
+        if (rv != -1 && flags != 0) {
+            self->zerocopy_sent++;
+        }
+#endif
 
         // check for failure
         #ifdef _WIN32
@@ -184,12 +394,204 @@ enum acs_code acs_send(struct acs *self, char *buf, size_t bytes)
 }
 
 enum acs_code acs_recv(struct acs *self, char *buf, size_t bytes)
+{
+    size_t received;
+
+    return acs_recv_some(self, buf, bytes, &received);
+}
+
+enum acs_code acs_recv_all(struct acs *self, char *buf, size_t bytes)
+{
+    enum acs_code code;
+    size_t received;
+    size_t offset = 0;
+
+    while (offset < bytes) {
+        code = acs_recv_some(self, &buf[offset], bytes - offset, &received);
+        if (code != ACS_OK) {
+            return code;
+        }
+        offset += received;
+    }
+    return ACS_OK;
+}
+
+int acs_set_zerocopy(struct acs *self, size_t threshold)
+{
+    assert(initialized);
+    assert(self);
+
+#ifdef HAVE_ZEROCOPY
+    self->zerocopy_min = threshold;
+    if (threshold == 0) {
+        self->zerocopy_on = 0;
+    }
+    else if (self->fd != -1 && !self->zerocopy_on) {
+        int one = 1;
+        self->zerocopy_on = setsockopt(self->fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0;
+    }
+    return 0;
+#else
+    (void)threshold;
+    return 1;
+#endif
+}
+
+uint64_t acs_zerocopy_mark(struct acs *self)
+{
+    assert(self);
+    return self->zerocopy_sent;
+}
+
+int acs_zerocopy_wait(struct acs *self, uint64_t mark, int timeout_ms)
+{
+    assert(initialized);
+    assert(self);
+
+#ifdef HAVE_ZEROCOPY
+    while (1) {
+        struct pollfd pfd;
+        int rv;
+
+        // a closed connection lets go of everything it had
+        if (self->fd == -1 || self->zerocopy_done >= mark) {
+            return 0;
+        }
+        zerocopy_reap(self);
+        if (self->zerocopy_done >= mark) {
+            return 0;
+        }
+        if (timeout_ms == 0) {
+            return 1;
+        }
+
+        // completions wake POLLERR, which is always polled for
+        pfd.fd = self->fd;
+        pfd.events = 0;
+        pfd.revents = 0;
+        rv = poll(&pfd, 1, timeout_ms);
+        if (rv == 0) {
+            zerocopy_reap(self);
+            return self->zerocopy_done < mark;
+        }
+        if (rv < 0 && errno != EINTR) {
+            return 1;
+        }
+    }
+#else
+    (void)mark;
+    (void)timeout_ms;
+    return 0;
+#endif
+}
+
+void acs_close(struct acs *self)
+{
+    assert(initialized);
+    assert(self);
+
+#ifdef ACS_URING
+    if (self->ring) {
+        ring_close(self, 0);
+        return;
+    }
+#endif
+
+    #ifdef _WIN32
+        if (self->fd != SOCKET_ERROR) {
+            (void)closesocket(self->fd);
+            self->fd = SOCKET_ERROR;
+        }
+    #else
+        if (self->fd != -1) {
+            (void)close(self->fd);
+            self->fd = -1;
+        }
+    #endif
+}
+
+size_t acs_poll_size(size_t count)
+{
+    #ifdef _WIN32
+        return count * sizeof(WSAPOLLFD);
+    #else
+        return count * sizeof(struct pollfd);
+    #endif
+}
+
+int acs_poll(struct acs **socks, size_t count, unsigned char *readable, int timeout_ms, void *scratch)
+{
+    #ifdef _WIN32
+        WSAPOLLFD *fds;
+    #else
+        struct pollfd *fds;
+    #endif
+    size_t i;
+    int rv;
+
+    assert(initialized);
+    assert(socks || count == 0);
+    assert(readable || count == 0);
+    assert(scratch || count == 0);
+
+    // nothing to wait on but the timeout
+    if (count == 0) {
+        #ifdef _WIN32
+            Sleep((timeout_ms < 0) ? INFINITE : (DWORD)timeout_ms);
+            return 0;
+        #else
+            return poll(NULL, 0, timeout_ms);
+        #endif
+    }
+
+    fds = scratch;
+    for (i = 0; i < count; i++) {
+        assert(socks[i]);
+        fds[i].fd = socks[i]->fd;
+        #ifdef _WIN32
+            fds[i].events = POLLRDNORM;
+        #else
+            fds[i].events = POLLIN;
+        #endif
+        fds[i].revents = 0;
+    }
+
+    #ifdef _WIN32
+        rv = WSAPoll(fds, (ULONG)count, timeout_ms);
+        if (rv == SOCKET_ERROR) {
+            #ifndef NDEBUG
+                (void)fprintf(stderr, "WSAPoll: Error: %d\n", WSAGetLastError());
+            #endif
+            rv = -1;
+        }
+    #else
+        rv = poll(fds, (nfds_t)count, timeout_ms);
+        if (rv == -1 && errno != EINTR) {
+            #ifndef NDEBUG
+                (void)fprintf(stderr, "poll: Error: %s\n", strerror(errno));
+            #endif
+        }
+        else if (rv == -1) {
+            rv = 0;
+        }
+    #endif
+
+    // a hang up or error reads as 0 bytes or an error, so recv finds out
+    for (i = 0; i < count; i++) {
+        readable[i] = (rv > 0 && fds[i].revents != 0) ? 1 : 0;
+    }
+
+    return rv;
+}
+
+enum acs_code acs_recv_some(struct acs *self, char *buf, size_t bytes, size_t *received)
 {
     int rv;
 
     assert(initialized);
     assert(self);
     assert(buf);
+    assert(received);
 
     // dial host if ever not connected
     if (
@@ -200,14 +602,14 @@ enum acs_code acs_recv(struct acs *self, char *buf, size_t bytes)
         #endif
         )
     {
-        rv = acs_dial(&self->fd, self->host, self->port);
-        if (rv != 0) {
+        if (acs_connect(self) != ACS_OK) {
             return ACS_ERROR;
         }
     }
 
     rv = recv(self->fd, buf, bytes, 0);
     if (rv > 0) {
+        *received = (size_t)rv;
         return ACS_OK;
     }
     else if (rv == 0) {
@@ -242,6 +644,684 @@ enum acs_code acs_recv(struct acs *self, char *buf, size_t bytes)
     }
 }
 
+struct acs_multicast *acs_multicast_new(const char *group, const char *port, const char *iface)
+{
+    struct acs_multicast *self;
+    struct sockaddr_in addr;
+    struct ip_mreq mreq;
+    unsigned long port_number;
+    char *end;
+    int opt;
+    #ifdef _WIN32
+        SOCKET sockfd;
+    #else
+        int sockfd;
+    #endif
+
+    assert(initialized);
+    assert(group);
+    assert(port);
+
+    (void)memset(&mreq, 0, sizeof(mreq));
+    if (inet_pton(AF_INET, group, &mreq.imr_multiaddr) != 1) {
+        return NULL;
+    }
+    mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+    if (iface && inet_pton(AF_INET, iface, &mreq.imr_interface) != 1) {
+        return NULL;
+    }
+    port_number = strtoul(port, &end, 10);
+    if (*end != '\0' || port_number == 0 || port_number > 65535) {
+        return NULL;
+    }
+
+    sockfd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    #ifdef _WIN32
+        if (sockfd == INVALID_SOCKET) {
+            #ifndef NDEBUG
+                (void)fprintf(stderr, "socket: Error: %d\n", WSAGetLastError());
+            #endif
+            return NULL;
+        }
+    #else
+        if (sockfd == -1) {
+            #ifndef NDEBUG
+                (void)fprintf(stderr, "socket: Error: %s\n", strerror(errno));
+            #endif
+            return NULL;
+        }
+    #endif
+
+    // every client on the host binds the group's port
+    opt = 1;
+    (void)setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, (const char *)&opt, sizeof(opt));
+    opt = MULTICAST_RCVBUF;
+    (void)setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, (const char *)&opt, sizeof(opt));
+
+    (void)memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons((unsigned short)port_number);
+
+    if (bind(sockfd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        setsockopt(sockfd, IPPROTO_IP, IP_ADD_MEMBERSHIP, (const char *)&mreq, sizeof(mreq)) != 0)
+    {
+        #ifndef NDEBUG
+            #ifdef _WIN32
+                (void)fprintf(stderr, "multicast: Error: %d\n", WSAGetLastError());
+            #else
+                (void)fprintf(stderr, "multicast: Error: %s\n", strerror(errno));
+            #endif // _WIN32
+        #endif
+        #ifdef _WIN32
+            (void)closesocket(sockfd);
+        #else
+            (void)close(sockfd);
+        #endif
+        return NULL;
+    }
+
+    self = acs_malloc(sizeof(*self));
+    if (!self) {
+        #ifdef _WIN32
+            (void)closesocket(sockfd);
+        #else
+            (void)close(sockfd);
+        #endif
+        return NULL;
+    }
+    self->fd = sockfd;
+    return self;
+}
+
+void acs_multicast_del(struct acs_multicast *self)
+{
+    assert(initialized);
+    assert(self);
+
+    // closing leaves the group
+    #ifdef _WIN32
+        (void)closesocket(self->fd);
+    #else
+        (void)close(self->fd);
+    #endif
+    acs_free(self);
+}
+
+int acs_multicast_recv(struct acs_multicast *self, char *buf, size_t bytes, size_t *received, int timeout_ms)
+{
+    #ifdef _WIN32
+        WSAPOLLFD fd;
+    #else
+        struct pollfd fd;
+    #endif
+    int rv;
+
+    assert(initialized);
+    assert(self);
+    assert(buf);
+    assert(received);
+
+    fd.fd = self->fd;
+    #ifdef _WIN32
+        fd.events = POLLRDNORM;
+    #else
+        fd.events = POLLIN;
+    #endif
+    fd.revents = 0;
+
+    #ifdef _WIN32
+        rv = WSAPoll(&fd, 1, timeout_ms);
+        if (rv == SOCKET_ERROR) {
+            return -1;
+        }
+    #else
+        rv = poll(&fd, 1, timeout_ms);
+        if (rv == -1) {
+            return (errno == EINTR) ? 0 : -1;
+        }
+    #endif
+    if (rv == 0) {
+        return 0;
+    }
+
+    #ifdef _WIN32
+        rv = recv(self->fd, buf, (int)bytes, 0);
+        // a datagram too long for buf still fills it
+        if (rv == SOCKET_ERROR && WSAGetLastError() == WSAEMSGSIZE) {
+            rv = (int)bytes;
+        }
+        if (rv == SOCKET_ERROR) {
+            return -1;
+        }
+    #else
+        rv = (int)recv(self->fd, buf, bytes, 0);
+        if (rv == -1) {
+            return (errno == EINTR || errno == EAGAIN) ? 0 : -1;
+        }
+    #endif
+
+    *received = (size_t)rv;
+    return 1;
+}
+
+uint64_t acs_time_us(void)
+{
+    #ifdef _WIN32
+        static LARGE_INTEGER freq = { 0 };
+        LARGE_INTEGER now;
+
+        if (freq.QuadPart == 0) {
+            (void)QueryPerformanceFrequency(&freq);
+        }
+        (void)QueryPerformanceCounter(&now);
+        return (uint64_t)(now.QuadPart / freq.QuadPart) * 1000000 +
+               (uint64_t)(now.QuadPart % freq.QuadPart) * 1000000 / freq.QuadPart;
+    #else
+        struct timespec ts;
+
+        (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+    #endif
+}
+
+#ifdef ACS_URING
+
+struct acs_ring *acs_ring_new(size_t count, size_t buffers, size_t buffer_size)
+{
+    struct acs_ring *self;
+    struct io_uring_params params;
+    struct io_uring_buf_reg reg;
+    unsigned entries;
+    unsigned i;
+
+    assert(initialized);
+    assert(count > 0);
+    assert(buffers > 0);
+    assert(buffer_size > 0);
+
+    self = acs_calloc(1, sizeof(*self));
+    if (!self) {
+        return NULL;
+    }
+    self->fd = -1;
+    self->held = -1;
+    self->buf_ring = MAP_FAILED;
+
+    // a send and a recv per connection, and a few being resent
+    for (entries = 8; entries < 2 * count + 8; entries *= 2);
+
+    (void)memset(&params, 0, sizeof(params));
+    self->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+    if (self->fd < 0) {
+        goto fail;
+    }
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_EXT_ARG)) {
+        goto fail;
+    }
+
+    self->queues_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    if (params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe) > self->queues_len) {
+        self->queues_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    }
+    self->queues = mmap(NULL, self->queues_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, self->fd, IORING_OFF_SQ_RING);
+    if (self->queues == MAP_FAILED) {
+        self->queues = NULL;
+        goto fail;
+    }
+    self->sq_head = (unsigned *)&self->queues[params.sq_off.head];
+    self->sq_tail = (unsigned *)&self->queues[params.sq_off.tail];
+    self->sq_mask = *(unsigned *)&self->queues[params.sq_off.ring_mask];
+    self->sq_entries = params.sq_entries;
+    self->sq_array = (unsigned *)&self->queues[params.sq_off.array];
+    self->sq_local = *self->sq_tail;
+    self->cq_head = (unsigned *)&self->queues[params.cq_off.head];
+    self->cq_tail = (unsigned *)&self->queues[params.cq_off.tail];
+    self->cq_mask = *(unsigned *)&self->queues[params.cq_off.ring_mask];
+    self->cqes = (struct io_uring_cqe *)&self->queues[params.cq_off.cqes];
+
+    self->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+    self->sqes = mmap(NULL, self->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, self->fd, IORING_OFF_SQES);
+    if (self->sqes == MAP_FAILED) {
+        self->sqes = NULL;
+        goto fail;
+    }
+
+    // the buffer ring has to be page aligned and a power of 2 long, buffer ids are 16 bits
+    for (self->buffer_count = 1; self->buffer_count < buffers && self->buffer_count < 32768; self->buffer_count *= 2);
+    self->buffer_size = buffer_size;
+    self->buf_ring_len = self->buffer_count * sizeof(struct io_uring_buf);
+    self->buf_ring = mmap(NULL, self->buf_ring_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (self->buf_ring == MAP_FAILED) {
+        goto fail;
+    }
+    self->buffers = acs_malloc(self->buffer_count * buffer_size);
+    if (!self->buffers) {
+        goto fail;
+    }
+
+    (void)memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)self->buf_ring;
+    reg.ring_entries = self->buffer_count;
+    reg.bgid = RING_GROUP;
+    if (syscall(__NR_io_uring_register, self->fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+        goto fail;
+    }
+    for (i = 0; i < self->buffer_count; i++) {
+        ring_buffer_put(self, i);
+    }
+
+    self->slots = acs_calloc(count, sizeof(*self->slots));
+    if (!self->slots) {
+        goto fail;
+    }
+    self->slot_max = count;
+
+    return self;
+
+fail:
+    acs_ring_del(self);
+    return NULL;
+}
+
+void acs_ring_del(struct acs_ring *self)
+{
+    size_t i;
+
+    assert(self);
+
+    for (i = 0; i < self->slot_count; i++) {
+        self->slots[i].sock->ring = NULL;
+    }
+    acs_free(self->slots);
+
+    // closing the ring cancels what it still has in flight
+    if (self->fd >= 0) {
+        (void)close(self->fd);
+    }
+    acs_free(self->buffers);
+    if (self->buf_ring != MAP_FAILED) {
+        (void)munmap(self->buf_ring, self->buf_ring_len);
+    }
+    if (self->sqes) {
+        (void)munmap(self->sqes, self->sqes_len);
+    }
+    if (self->queues) {
+        (void)munmap(self->queues, self->queues_len);
+    }
+    acs_free(self);
+}
+
+void acs_ring_add(struct acs_ring *self, struct acs *sock, void *tag)
+{
+    struct ring_slot *slot;
+
+    assert(initialized);
+    assert(self);
+    assert(sock);
+    assert(!sock->ring);
+    assert(self->slot_count < self->slot_max);
+
+    slot = &self->slots[self->slot_count];
+    (void)memset(slot, 0, sizeof(*slot));
+    slot->sock = sock;
+    slot->tag = tag;
+    sock->ring = self;
+    sock->ring_slot = self->slot_count++;
+}
+
+enum acs_code acs_ring_send(struct acs_ring *self, struct acs *sock, const char *buf, size_t bytes)
+{
+    struct ring_slot *slot;
+
+    assert(initialized);
+    assert(self);
+    assert(sock && sock->ring == self);
+    assert(buf);
+
+    slot = &self->slots[sock->ring_slot];
+    assert(!slot->send_buf);
+
+    if (slot->failed) {
+        slot->failed = 0;
+        return ACS_ERROR;
+    }
+    if (sock->fd == -1) {
+        if (acs_connect(sock) != ACS_OK) {
+            return ACS_ERROR;
+        }
+    }
+    if (!slot->armed) {
+        ring_arm(self, slot);
+    }
+
+    slot->send_buf = buf;
+    slot->send_size = bytes;
+    slot->send_done = 0;
+    ring_send_rest(self, slot);
+
+    return ACS_OK;
+}
+
+int acs_ring_wait(struct acs_ring *self, int timeout_ms)
+{
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    unsigned flags = IORING_ENTER_EXT_ARG;
+    unsigned ready;
+    long rv;
+
+    assert(initialized);
+    assert(self);
+
+    // publish what was queued, the kernel takes it all in the same call
+    __atomic_store_n(self->sq_tail, self->sq_local, __ATOMIC_RELEASE);
+
+    (void)memset(&arg, 0, sizeof(arg));
+    ready = __atomic_load_n(self->cq_tail, __ATOMIC_ACQUIRE) - *self->cq_head;
+    if (ready == 0) {
+        flags |= IORING_ENTER_GETEVENTS;
+        if (timeout_ms >= 0) {
+            ts.tv_sec = timeout_ms / 1000;
+            ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+            arg.ts = (uint64_t)(uintptr_t)&ts;
+        }
+    }
+
+    rv = syscall(__NR_io_uring_enter, self->fd, self->sq_local - __atomic_load_n(self->sq_head, __ATOMIC_ACQUIRE),
+        (ready == 0) ? 1 : 0, flags, &arg, sizeof(arg));
+    if (rv < 0 && errno != ETIME && errno != EINTR) {
+        #ifndef NDEBUG
+            (void)fprintf(stderr, "io_uring_enter: Error: %s\n", strerror(errno));
+        #endif
+        return -1;
+    }
+
+    return (int)(__atomic_load_n(self->cq_tail, __ATOMIC_ACQUIRE) - *self->cq_head);
+}
+
+int acs_ring_next(struct acs_ring *self, struct acs_ring_event *event)
+{
+    struct io_uring_cqe cqe;
+    struct ring_slot *slot;
+    unsigned head;
+    unsigned kind;
+    int stale;
+
+    assert(initialized);
+    assert(self);
+    assert(event);
+
+    // the caller is done with the last recv's bytes
+    if (self->held >= 0) {
+        ring_buffer_put(self, (unsigned)self->held);
+        self->held = -1;
+    }
+
+    while (1) {
+        head = *self->cq_head;
+        if (head == __atomic_load_n(self->cq_tail, __ATOMIC_ACQUIRE)) {
+            return 0;
+        }
+        cqe = self->cqes[head & self->cq_mask];
+        __atomic_store_n(self->cq_head, head + 1, __ATOMIC_RELEASE);
+
+        slot = &self->slots[cqe.user_data >> 32];
+        kind = (unsigned)(cqe.user_data & 3);
+        stale = ((cqe.user_data >> 2) & RING_SEQ_MASK) != (slot->seq & RING_SEQ_MASK);
+        event->tag = slot->tag;
+        event->data = NULL;
+        event->size = 0;
+
+        if (kind == RING_RECV) {
+            if (!stale && !(cqe.flags & IORING_CQE_F_MORE)) {
+                slot->armed = 0;
+            }
+            if (stale || cqe.res == -ENOBUFS) {
+                if (cqe.flags & IORING_CQE_F_BUFFER) {
+                    ring_buffer_put(self, cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+                }
+                // out of buffers ends a multishot recv, there are some again by the next wait
+                if (!stale && !slot->armed) {
+                    ring_arm(self, slot);
+                }
+                continue;
+            }
+
+            event->kind = ACS_RING_RECV;
+            if (cqe.res > 0) {
+                self->held = (int)(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+                event->code = ACS_OK;
+                event->data = (const char *)&self->buffers[(size_t)self->held * self->buffer_size];
+                event->size = (size_t)cqe.res;
+                if (!slot->armed) {
+                    ring_arm(self, slot);
+                }
+                return 1;
+            }
+
+            #ifndef NDEBUG
+                if (cqe.res == 0) {
+                    (void)fprintf(stderr, "recv: Connection closed\n");
+                }
+                else {
+                    (void)fprintf(stderr, "recv: Error: %s\n", strerror(-cqe.res));
+                }
+            #endif
+            event->code = (cqe.res == 0) ? ACS_RESET : ACS_ERROR;
+            ring_close(slot->sock, 1);
+            return 1;
+        }
+
+        if (stale) {
+            continue;
+        }
+
+        event->kind = ACS_RING_SEND;
+        if (cqe.res < 0) {
+            #ifndef NDEBUG
+                (void)fprintf(stderr, "send: Error: %s\n", strerror(-cqe.res));
+            #endif
+            event->code = ACS_ERROR;
+            ring_close(slot->sock, 1);
+            return 1;
+        }
+
+        slot->send_done += (size_t)cqe.res;
+        if (slot->send_done < slot->send_size) {
+            ring_send_rest(self, slot);
+            continue;
+        }
+        slot->send_buf = NULL;
+        event->code = ACS_OK;
+        return 1;
+    }
+}
+
+static struct io_uring_sqe *ring_sqe(struct acs_ring *self, struct ring_slot *slot, unsigned kind)
+{
+    struct io_uring_sqe *sqe;
+    unsigned index;
+
+    // full, hand the kernel what is there to make room
+    if (self->sq_local - __atomic_load_n(self->sq_head, __ATOMIC_ACQUIRE) == self->sq_entries) {
+        __atomic_store_n(self->sq_tail, self->sq_local, __ATOMIC_RELEASE);
+        (void)syscall(__NR_io_uring_enter, self->fd, self->sq_entries, 0, 0, NULL, 0);
+    }
+
+    index = self->sq_local & self->sq_mask;
+    sqe = &self->sqes[index];
+    (void)memset(sqe, 0, sizeof(*sqe));
+    sqe->fd = slot->sock->fd;
+    sqe->user_data = ((uint64_t)(slot - self->slots) << 32) | ((uint64_t)(slot->seq & RING_SEQ_MASK) << 2) | kind;
+    self->sq_array[index] = index;
+    self->sq_local++;
+
+    return sqe;
+}
+
+static void ring_buffer_put(struct acs_ring *self, unsigned id)
+{
+    struct io_uring_buf *buf;
+
+    buf = &self->buf_ring->bufs[self->buf_tail & (self->buffer_count - 1)];
+    buf->addr = (uint64_t)(uintptr_t)&self->buffers[(size_t)id * self->buffer_size];
+    buf->len = (uint32_t)self->buffer_size;
+    buf->bid = (uint16_t)id;
+    self->buf_tail++;
+    __atomic_store_n(&self->buf_ring->tail, self->buf_tail, __ATOMIC_RELEASE);
+}
+
+static void ring_arm(struct acs_ring *self, struct ring_slot *slot)
+{
+    struct io_uring_sqe *sqe;
+
+    sqe = ring_sqe(self, slot, RING_RECV);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = RING_GROUP;
+    slot->armed = 1;
+}
+
+static void ring_send_rest(struct acs_ring *self, struct ring_slot *slot)
+{
+    struct io_uring_sqe *sqe;
+
+    sqe = ring_sqe(self, slot, RING_SEND);
+    sqe->opcode = IORING_OP_SEND;
+    sqe->addr = (uint64_t)(uintptr_t)&slot->send_buf[slot->send_done];
+    sqe->len = (uint32_t)(slot->send_size - slot->send_done);
+}
+
+static void ring_close(struct acs *sock, int failed)
+{
+    struct ring_slot *slot;
+
+    slot = &sock->ring->slots[sock->ring_slot];
+
+    // the ring holds the socket open while a recv is outstanding, shutting
+    // it down ends that recv, whose completion is stale by then
+    if (sock->fd != -1) {
+        (void)shutdown(sock->fd, SHUT_RDWR);
+        (void)close(sock->fd);
+        sock->fd = -1;
+    }
+    slot->seq++;
+    slot->armed = 0;
+    slot->failed = failed;
+    slot->send_buf = NULL;
+}
+
+#else
+
+struct acs_ring *acs_ring_new(size_t count, size_t buffers, size_t buffer_size)
+{
+    (void)count;
+    (void)buffers;
+    (void)buffer_size;
+    return NULL;
+}
+
+void acs_ring_del(struct acs_ring *self)
+{
+    (void)self;
+    assert(0);
+}
+
+void acs_ring_add(struct acs_ring *self, struct acs *sock, void *tag)
+{
+    (void)self;
+    (void)sock;
+    (void)tag;
+    assert(0);
+}
+
+enum acs_code acs_ring_send(struct acs_ring *self, struct acs *sock, const char *buf, size_t bytes)
+{
+    (void)self;
+    (void)sock;
+    (void)buf;
+    (void)bytes;
+    assert(0);
+    return ACS_ERROR;
+}
+
+int acs_ring_wait(struct acs_ring *self, int timeout_ms)
+{
+    (void)self;
+    (void)timeout_ms;
+    assert(0);
+    return -1;
+}
+
+int acs_ring_next(struct acs_ring *self, struct acs_ring_event *event)
+{
+    (void)self;
+    (void)event;
+    assert(0);
+    return 0;
+}
+
+#endif // ACS_URING
+
+static enum acs_code acs_connect(struct acs *self)
+{
+    if (acs_dial(&self->fd, self->host, self->port) != ACS_OK) {
+        return ACS_ERROR;
+    }
+
+    // the kernel numbers the sends of each socket from 0
+    self->zerocopy_base = self->zerocopy_sent;
+    self->zerocopy_done = self->zerocopy_sent;
+    self->zerocopy_on = 0;
+
+#ifdef HAVE_ZEROCOPY
+    if (self->zerocopy_min > 0) {
+        int one = 1;
+        self->zerocopy_on = setsockopt(self->fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0;
+    }
+#endif
+
+    return ACS_OK;
+}
+
+#ifdef HAVE_ZEROCOPY
+
+static void zerocopy_reap(struct acs *self)
+{
+    char control[128];
+    struct msghdr msg;
+    struct cmsghdr *cm;
+    struct sock_extended_err *ee;
+
+    while (1) {
+        (void)memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(self->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1) {
+            return;
+        }
+
+        for (cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+            if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+                  (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))) {
+                continue;
+            }
+            ee = (struct sock_extended_err *)CMSG_DATA(cm);
+            if (ee->ee_errno != 0 || ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+            // sends ee_info thru ee_data are done, they finish in order
+            if (self->zerocopy_base + ee->ee_data + 1 > self->zerocopy_done) {
+                self->zerocopy_done = self->zerocopy_base + ee->ee_data + 1;
+            }
+        }
+    }
+}
+
+#endif // HAVE_ZEROCOPY
+
 static enum acs_code acs_dial(
     #ifdef _WIN32
         SOCKET *clientfd,
@@ -264,6 +1344,13 @@ static enum acs_code acs_dial(
     assert(host);
     assert(port);
 
+    #ifndef _WIN32
+        // a path is a Unix domain socket, such as a host-local acs_relay.py
+        if (host[0] == '/') {
+            return acs_dial_unix(clientfd, host);
+        }
+    #endif
+
     (void)memset(&hints, 0, sizeof(hints));
     hints.ai_family = AF_UNSPEC;
     hints.ai_socktype = SOCK_STREAM;
@@ -332,3 +1419,36 @@ static enum acs_code acs_dial(
     *clientfd = sockfd;
     return ACS_OK;
 }
+
+#ifndef _WIN32
+
+static enum acs_code acs_dial_unix(int *clientfd, const char *path)
+{
+    struct sockaddr_un addr;
+    int sockfd;
+
+    (void)memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        return ACS_ERROR;
+    }
+    (void)strcpy(addr.sun_path, path);
+
+    sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sockfd == -1) {
+        #ifndef NDEBUG
+            (void)fprintf(stderr, "socket: Error: %s\n", strerror(errno));
+        #endif
+        return ACS_ERROR;
+    }
+
+    if (connect(sockfd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        (void)close(sockfd);
+        return ACS_ERROR;
+    }
+
+    *clientfd = sockfd;
+    return ACS_OK;
+}
+
+#endif // _WIN32
@@ -2,14 +2,22 @@
 #define ACTUAL_C_SOCKETS_H
 
 /**
- * ACS just blocking TCP client sockets, use something
- * easier for servers like Python's socketserver
+ * ACS client sockets, use something easier for servers like Python's
+ * socketserver. Blocking TCP, or a Unix domain socket when the host is a
+ * path, with MSG_ZEROCOPY sends on Linux. acs_poll waits on many at once,
+ * acs_ring batches their IO thru io_uring when built with -DACS_URING, and
+ * acs_multicast receives datagrams from a UDP multicast group.
  * 
  * Works on Windows (Visual C)
  * Works on Unix-based
  */
 
 #include <stddef.h> // size_t
+#include <stdint.h> // uint64_t
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 struct acs;
 
@@ -19,11 +27,37 @@ enum acs_code {
     ACS_RESET,
 };
 
+/**
+ * Where ACS gets its heap memory, malloc by default. Each call gets \a ctx
+ */
+struct acs_allocator {
+    void *(*malloc)(size_t size, void *ctx);
+    void *(*realloc)(void *ptr, size_t size, void *ctx);
+    void (*free)(void *ptr, void *ctx);
+    void *ctx;
+};
+
 enum acs_code acs_init(void);
 void acs_cleanup(void);
 
 /**
- * Create an acs struct to connect with, acs_init must have been called
+ * Have ACS and ACS_SYNC allocate with \a allocator, NULL for malloc again.
+ * Only call this before acs_init, or after acs_cleanup once everything is freed
+ */
+void acs_set_allocator(const struct acs_allocator *allocator);
+
+/**
+ * malloc, calloc, realloc and free thru the allocator
+ */
+void *acs_malloc(size_t size);
+void *acs_calloc(size_t count, size_t size);
+void *acs_realloc(void *ptr, size_t size);
+void acs_free(void *ptr);
+
+/**
+ * Create an acs struct to connect with, acs_init must have been called. On
+ * Unix-based, a \a host starting with / is the path of a Unix domain socket
+ * and \a port is ignored
  */
 struct acs *acs_new(const char *host, const char *port);
 
@@ -43,4 +77,174 @@ void acs_del(struct acs *self);
 enum acs_code acs_send(struct acs *self, char *buf, size_t bytes);
 enum acs_code acs_recv(struct acs *self, char *buf, size_t bytes);
 
+/**
+ * Like acs_recv, but tell how many bytes arrived in \a received
+ */
+enum acs_code acs_recv_some(struct acs *self, char *buf, size_t bytes, size_t *received);
+
+/**
+ * Like acs_recv, but keep receiving until all \a bytes of \a buf are filled
+ */
+enum acs_code acs_recv_all(struct acs *self, char *buf, size_t bytes);
+
+/**
+ * Drop the connection, the next send or recv dials again
+ */
+void acs_close(struct acs *self);
+
+/**
+ * Send what is \a threshold bytes or more without copying it, thru Linux
+ * MSG_ZEROCOPY, 0 to stop. The kernel then reads straight from the buffer
+ * given to acs_send after it returned, so the buffer must not change until
+ * acs_zerocopy_wait says so. Only pays off for sends of about 10 KB or more
+ * to another host, the kernel copies to loopback anyway.
+ * 
+ * \return
+ *       0 set, it applies from the next send
+ *       1 not supported here, every send copies
+ */
+int acs_set_zerocopy(struct acs *self, size_t threshold);
+
+/**
+ * Mark to pass acs_zerocopy_wait for every send made so far
+ */
+uint64_t acs_zerocopy_mark(struct acs *self);
+
+/**
+ * Wait up to \a timeout_ms milliseconds, -1 for ever, 0 not at all, until the
+ * kernel is done with the buffers of all sends up to \a mark. Those of a
+ * closed connection are always done.
+ * 
+ * \return
+ *       0 the buffers can change
+ *       1 some are still in use
+ */
+int acs_zerocopy_wait(struct acs *self, uint64_t mark, int timeout_ms);
+
+/**
+ * Wait up to \a timeout_ms milliseconds, -1 for ever, until one of \a count
+ * connected sockets has something to recv, which then won't block. Sets
+ * \a readable[i] to whether \a socks[i] does, a closed connection counts.
+ * \a scratch holds acs_poll_size(\a count) bytes, so polling in a loop
+ * allocates nothing.
+ * 
+ * \return
+ *       the number of readable sockets, 0 on timeout
+ *      -1 poll error
+ */
+int acs_poll(struct acs **socks, size_t count, unsigned char *readable, int timeout_ms, void *scratch);
+
+/**
+ * Bytes of scratch acs_poll needs for \a count sockets
+ */
+size_t acs_poll_size(size_t count);
+
+/**
+ * Batched IO on many connections thru Linux io_uring (6.0 or later), compile
+ * with -DACS_URING. Sends queued on the ring and the receives of every
+ * connection on it go to the kernel in one syscall per acs_ring_wait instead
+ * of one each. Each connection keeps one multishot recv outstanding, which
+ * lands in buffers registered with the kernel up front.
+ */
+struct acs_ring;
+
+enum acs_ring_kind {
+    ACS_RING_SEND,
+    ACS_RING_RECV,
+};
+
+struct acs_ring_event {
+    void *tag;               // as given to acs_ring_add
+    enum acs_ring_kind kind;
+    enum acs_code code;      // ACS_RESET or ACS_ERROR have closed the connection, like acs_recv_some
+    const char *data;        // received bytes, only valid until the next acs_ring_next
+    size_t size;
+};
+
+/**
+ * Create a ring for up to \a count connections with \a buffers of
+ * \a buffer_size bytes to recv into. Returns NULL if io_uring is not compiled
+ * in or the kernel lacks it, so the caller can fall back to acs_poll
+ */
+struct acs_ring *acs_ring_new(size_t count, size_t buffers, size_t buffer_size);
+
+/**
+ * Free a ring, its connections stay open to use without it
+ */
+void acs_ring_del(struct acs_ring *self);
+
+/**
+ * Put \a sock on the ring, its events carry \a tag. acs_close then also
+ * ends its outstanding recv
+ */
+void acs_ring_add(struct acs_ring *self, struct acs *sock, void *tag);
+
+/**
+ * Queue a send of \a bytes of \a buf, which must stay put until its event.
+ * Dials first if needed, which blocks, and starts receiving on a fresh
+ * connection. Only one send per connection may be in flight.
+ *
+ * \return
+ *       0 queued
+ *      -1 acs_dial error, or an event closed the connection since the
+ *         last send, as acs_send would find out
+ */
+enum acs_code acs_ring_send(struct acs_ring *self, struct acs *sock, const char *buf, size_t bytes);
+
+/**
+ * Submit what was queued and wait up to \a timeout_ms milliseconds, -1 for
+ * ever, until there are events
+ *
+ * \return
+ *       the number of events ready, 0 on timeout
+ *      -1 io_uring_enter error
+ */
+int acs_ring_wait(struct acs_ring *self, int timeout_ms);
+
+/**
+ * Take the next event into \a event, return 0 when there are no more. A send
+ * has one once all of it went out or it failed
+ */
+int acs_ring_next(struct acs_ring *self, struct acs_ring_event *event);
+
+/**
+ * Datagrams a server sends to an IPv4 multicast group, for many clients on a
+ * LAN to get the same bytes from one send
+ */
+struct acs_multicast;
+
+/**
+ * Join multicast \a group, such as 239.255.0.1, on \a port. \a iface is the
+ * address of the interface to join on, 127.0.0.1 for loopback, NULL for the
+ * one the routes pick. Several may join the same group and port on a host.
+ * Returns NULL if it cannot be joined
+ */
+struct acs_multicast *acs_multicast_new(const char *group, const char *port, const char *iface);
+
+/**
+ * Leave the group
+ */
+void acs_multicast_del(struct acs_multicast *self);
+
+/**
+ * Wait up to \a timeout_ms milliseconds, -1 for ever, 0 not at all, for the
+ * next datagram into \a buf. One longer than \a bytes is cut short, and
+ * \a received says how much of it is there.
+ *
+ * \return
+ *       1 a datagram
+ *       0 timeout
+ *      -1 recv error
+ */
+int acs_multicast_recv(struct acs_multicast *self, char *buf, size_t bytes, size_t *received, int timeout_ms);
+
+/**
+ * Monotonic clock in microseconds, only useful for measuring intervals
+ */
+uint64_t acs_time_us(void);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif // ACTUAL_C_SOCKETS_H
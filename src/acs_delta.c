@@ -0,0 +1,148 @@
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "acs_delta.h"
+
+#define DICT_AT(DICT, DICT_SIZE, I) (((I) < (DICT_SIZE)) ? (DICT)[I] : 0)
+
+static unsigned char *varint_put(unsigned char *dst, size_t value)
+{
+    while (value >= 0x80) {
+        *dst++ = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    *dst++ = (unsigned char)value;
+    return dst;
+}
+
+static int varint_get(const unsigned char **src, const unsigned char *end, size_t *value)
+{
+    unsigned shift = 0;
+
+    *value = 0;
+    while (*src < end && shift < 35) {
+        *value |= (size_t)(**src & 0x7f) << shift;
+        if ((*(*src)++ & 0x80) == 0) {
+            return 0;
+        }
+        shift += 7;
+    }
+    return 1;
+}
+
+static unsigned char *literal_put(unsigned char *dst, const unsigned char *src, size_t size)
+{
+    if (size > 0) {
+        dst = varint_put(dst, size << 1);
+        (void)memcpy(dst, src, size);
+        dst += size;
+    }
+    return dst;
+}
+
+size_t acs_delta_encode(const void *src, size_t size, const void *dict, size_t dict_size, void *dst)
+{
+    const unsigned char *in = src;
+    const unsigned char *base = dict;
+    unsigned char *out = dst;
+    uint32_t raw_size;
+    size_t literal = 0; // start of the literals not written yet
+    size_t i = 0;
+    size_t j;
+
+    assert(src || size == 0);
+    assert(dict || dict_size == 0);
+    assert(dst);
+
+    raw_size = (uint32_t)size;
+    (void)memcpy(out, &raw_size, sizeof(raw_size));
+    out += sizeof(raw_size);
+
+    while (i < size) {
+        if (in[i] != DICT_AT(base, dict_size, i)) {
+            i++;
+            continue;
+        }
+
+        for (j = i + 1; j < size && in[j] == DICT_AT(base, dict_size, j); j++);
+
+        if (j - i >= ACS_DELTA_MIN_RUN) {
+            out = literal_put(out, &in[literal], i - literal);
+            out = varint_put(out, ((j - i) << 1) | 1);
+            literal = j;
+        }
+        i = j;
+    }
+    out = literal_put(out, &in[literal], size - literal);
+
+    return (size_t)(out - (unsigned char *)dst);
+}
+
+int acs_delta_raw_size(const void *src, size_t size, size_t *raw_size)
+{
+    uint32_t tmp;
+
+    assert(src || size == 0);
+    assert(raw_size);
+
+    if (size < sizeof(tmp)) {
+        return 1;
+    }
+    (void)memcpy(&tmp, src, sizeof(tmp));
+    *raw_size = tmp;
+    return 0;
+}
+
+int acs_delta_decode(const void *src, size_t size, const void *dict, size_t dict_size, void *dst)
+{
+    const unsigned char *in = src;
+    const unsigned char *end = in + size;
+    const unsigned char *base = dict;
+    unsigned char *out = dst;
+    size_t raw_size;
+    size_t pos = 0;
+    size_t count;
+    size_t v;
+
+    assert(dict || dict_size == 0);
+    assert(dst);
+
+    if (acs_delta_raw_size(src, size, &raw_size) != 0) {
+        return 1;
+    }
+    in += sizeof(uint32_t);
+
+    while (pos < raw_size) {
+        if (varint_get(&in, end, &v) != 0) {
+            return 1;
+        }
+        count = v >> 1;
+        if (count > raw_size - pos) {
+            return 1;
+        }
+
+        // literals
+        if ((v & 1) == 0) {
+            if (count > (size_t)(end - in)) {
+                return 1;
+            }
+            (void)memcpy(&out[pos], in, count);
+            in += count;
+        }
+        // run of the dictionary, zeros past its end
+        else if (pos >= dict_size) {
+            (void)memset(&out[pos], 0, count);
+        }
+        else if (count > dict_size - pos) {
+            (void)memcpy(&out[pos], &base[pos], dict_size - pos);
+            (void)memset(&out[dict_size], 0, count - (dict_size - pos));
+        }
+        else {
+            (void)memcpy(&out[pos], &base[pos], count);
+        }
+        pos += count;
+    }
+
+    return (in == end) ? 0 : 1;
+}
@@ -0,0 +1,49 @@
+#ifndef ACS_DELTA_H
+#define ACS_DELTA_H
+
+/**
+ * Delta coding of a frame against the previous frame of its kind, the
+ * dictionary. Flatdata changes little between round trips, so most of a
+ * frame is bytes equal to the dictionary at the same offset, which cost a
+ * few bytes per run instead of their size. The dictionary reads as zeros
+ * past its end, so padding compresses even without one.
+ *
+ * Coded: uint32_t raw size, then tokens until that many bytes are out. A
+ * token is a LEB128 varint v, with v >> 1 bytes that follow as they are if
+ * v & 1 is 0, or that many bytes copied from the dictionary if it is 1.
+ * acs_sync.py has the same coder for the server.
+ */
+
+#include <stddef.h> // size_t
+
+#define ACS_DELTA_MIN_RUN 8 // shorter runs stay in the literals around them
+
+// most bytes acs_delta_encode writes for SIZE raw bytes
+#define ACS_DELTA_BOUND(SIZE) ((SIZE) + 16)
+
+/**
+ * Code @a size bytes of @a src against @a dict into @a dst, which must hold
+ * ACS_DELTA_BOUND(@a size) bytes. Returns the coded size
+ */
+size_t acs_delta_encode(const void *src, size_t size, const void *dict, size_t dict_size, void *dst);
+
+/**
+ * Read the raw size from the @a size coded bytes at @a src.
+ *
+ * \return
+ *       0 success
+ *       1 too short to hold one
+ */
+int acs_delta_raw_size(const void *src, size_t size, size_t *raw_size);
+
+/**
+ * Decode @a size bytes of @a src against @a dict into @a dst, which must
+ * hold the raw size.
+ *
+ * \return
+ *       0 success
+ *       1 malformed input
+ */
+int acs_delta_decode(const void *src, size_t size, const void *dict, size_t dict_size, void *dst);
+
+#endif // ACS_DELTA_H
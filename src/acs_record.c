@@ -0,0 +1,217 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "acs.h"
+#include "acs_record.h"
+
+#ifdef _WIN32
+
+#undef UNICODE
+#define WIN32_LEAN_AND_MEAN
+
+#include <windows.h>
+
+#else // UNIX-based
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+
+#endif // _WIN32
+
+#define HEADER_SIZE 16
+#define ENTRY_SIZE 24
+#define PAD8(SIZE) (((SIZE) + 7) & ~(size_t)7)
+
+struct acs_record {
+    char *path;          // PATH plus room for the segment number
+    size_t base;         // length of PATH in path
+    size_t segment_size;
+    uint32_t origin;
+    unsigned segment;    // number of the mapped segment
+    unsigned char *map;  // NULL once the log stopped
+    size_t mapped;       // bytes mapped
+    size_t used;         // bytes written
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#else
+    int fd;
+#endif
+};
+
+static int segment_open(struct acs_record *self, size_t size); // map a new segment of size bytes
+static void segment_close(struct acs_record *self);            // trim and unmap the current segment
+
+struct acs_record *acs_record_new(const char *path, size_t segment_size, uint32_t origin)
+{
+    struct acs_record *self;
+
+    assert(path);
+
+    if (segment_size == 0) {
+        segment_size = ACS_RECORD_SEGMENT;
+    }
+    if (segment_size < HEADER_SIZE + ENTRY_SIZE) {
+        segment_size = HEADER_SIZE + ENTRY_SIZE;
+    }
+
+    self = acs_calloc(1, sizeof(*self));
+    if (!self) {
+        return NULL;
+    }
+
+    self->base = strlen(path);
+    self->path = acs_malloc(self->base + 16);
+    if (!self->path) {
+        acs_free(self);
+        return NULL;
+    }
+    (void)memcpy(self->path, path, self->base + 1);
+    self->segment_size = segment_size;
+    self->origin = origin;
+
+    if (segment_open(self, segment_size) != 0) {
+        acs_free(self->path);
+        acs_free(self);
+        return NULL;
+    }
+
+    return self;
+}
+
+void acs_record_del(struct acs_record *self)
+{
+    assert(self);
+
+    if (self->map) {
+        segment_close(self);
+    }
+    acs_free(self->path);
+    acs_free(self);
+}
+
+int acs_record_put(struct acs_record *self, uint32_t conn, uint32_t dir, uint32_t type, const void *payload, size_t size)
+{
+    unsigned char *at;
+    uint64_t time;
+    uint32_t size32;
+    size_t need;
+
+    assert(self);
+    assert(payload || size == 0);
+
+    if (!self->map) {
+        return 1;
+    }
+
+    need = ENTRY_SIZE + PAD8(size);
+    if (self->used + need > self->mapped) {
+        segment_close(self);
+        self->segment++;
+        if (segment_open(self, (HEADER_SIZE + need > self->segment_size) ? HEADER_SIZE + need : self->segment_size) != 0) {
+            return 1;
+        }
+    }
+
+    // 0 ends a segment, a clock that has not ticked yet cannot look like it
+    time = acs_time_us();
+    if (time == 0) {
+        time = 1;
+    }
+    size32 = (uint32_t)size;
+
+    at = &self->map[self->used];
+    (void)memcpy(&at[0], &time, sizeof(time));
+    (void)memcpy(&at[8], &conn, sizeof(conn));
+    (void)memcpy(&at[12], &dir, sizeof(dir));
+    (void)memcpy(&at[16], &type, sizeof(type));
+    (void)memcpy(&at[20], &size32, sizeof(size32));
+    if (size > 0) {
+        (void)memcpy(&at[ENTRY_SIZE], payload, size);
+    }
+    self->used += need;
+
+    return 0;
+}
+
+static int segment_open(struct acs_record *self, size_t size)
+{
+    uint32_t version = ACS_RECORD_VERSION;
+    uint32_t reserved = 0;
+
+    (void)snprintf(&self->path[self->base], 16, ".%06u", self->segment);
+
+#ifdef _WIN32
+    self->file = CreateFileA(self->path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (self->file == INVALID_HANDLE_VALUE) {
+        self->map = NULL;
+        return 1;
+    }
+    self->mapping = CreateFileMappingA(self->file, NULL, PAGE_READWRITE, (DWORD)((uint64_t)size >> 32), (DWORD)size, NULL);
+    if (!self->mapping) {
+        (void)CloseHandle(self->file);
+        self->map = NULL;
+        return 1;
+    }
+    self->map = MapViewOfFile(self->mapping, FILE_MAP_WRITE, 0, 0, size);
+    if (!self->map) {
+        (void)CloseHandle(self->mapping);
+        (void)CloseHandle(self->file);
+        return 1;
+    }
+#else
+    self->fd = open(self->path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (self->fd < 0) {
+        self->map = NULL;
+        return 1;
+    }
+    if (ftruncate(self->fd, (off_t)size) != 0) {
+        (void)close(self->fd);
+        self->map = NULL;
+        return 1;
+    }
+    self->map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, self->fd, 0);
+    if (self->map == MAP_FAILED) {
+        (void)close(self->fd);
+        self->map = NULL;
+        return 1;
+    }
+#endif // _WIN32
+
+    self->mapped = size;
+    (void)memcpy(&self->map[0], "ACSL", 4);
+    (void)memcpy(&self->map[4], &version, sizeof(version));
+    (void)memcpy(&self->map[8], &self->origin, sizeof(self->origin));
+    (void)memcpy(&self->map[12], &reserved, sizeof(reserved));
+    self->used = HEADER_SIZE;
+
+    return 0;
+}
+
+static void segment_close(struct acs_record *self)
+{
+#ifdef _WIN32
+    LARGE_INTEGER end;
+
+    (void)UnmapViewOfFile(self->map);
+    (void)CloseHandle(self->mapping);
+    end.QuadPart = (LONGLONG)self->used;
+    if (SetFilePointerEx(self->file, end, NULL, FILE_BEGIN)) {
+        (void)SetEndOfFile(self->file);
+    }
+    (void)CloseHandle(self->file);
+#else
+    int rv;
+
+    (void)munmap(self->map, self->mapped);
+    // on failure the zeroed tail still ends the segment
+    rv = ftruncate(self->fd, (off_t)self->used);
+    (void)rv;
+    (void)close(self->fd);
+#endif // _WIN32
+
+    self->map = NULL;
+}
@@ -0,0 +1,62 @@
+#ifndef ACS_RECORD_H
+#define ACS_RECORD_H
+
+/**
+ * Frame logs for record and replay, see acs_sync_set_record and
+ * acs_replay.py.
+ *
+ * A log is a run of segment files named PATH.000000, PATH.000001, ... each
+ * memory mapped while it is written. A segment opens with a header:
+ *
+ *     char magic[4] = "ACSL"; uint32_t version; uint32_t origin; uint32_t reserved;
+ *
+ * origin being ACS_RECORD_CLIENT or ACS_RECORD_SERVER, then holds entries:
+ *
+ *     uint64_t time; uint32_t conn; uint32_t dir; uint32_t type; uint32_t size;
+ *
+ * each followed by the frame payload padded to 8 bytes. time is acs_time_us,
+ * conn tells connections of a server log apart, type and size are those of
+ * the frame header. An entry with time 0, or the end of the file, ends the
+ * segment. acs_sync.py writes the same layout for the server.
+ */
+
+#include <stddef.h> // size_t
+#include <stdint.h>
+
+#define ACS_RECORD_VERSION 1
+
+#define ACS_RECORD_CLIENT 0 // origin of a log written by acs_sync
+#define ACS_RECORD_SERVER 1 // origin of a log written by acs_sync.py
+
+#define ACS_RECORD_RECV 0 // dir of a frame the writer received
+#define ACS_RECORD_SEND 1 // dir of a frame the writer sent
+
+#ifndef ACS_RECORD_SEGMENT
+#define ACS_RECORD_SEGMENT (64 * 1024 * 1024) // default bytes per segment
+#endif
+
+struct acs_record;
+
+/**
+ * Start a log at @a path with segments of @a segment_size bytes, 0 for
+ * ACS_RECORD_SEGMENT. Returns NULL if the first segment cannot be created
+ */
+struct acs_record *acs_record_new(const char *path, size_t segment_size, uint32_t origin);
+
+/**
+ * Trim the last segment to what was written, unmap it and free the log
+ */
+void acs_record_del(struct acs_record *self);
+
+/**
+ * Append a frame stamped with the current time. An entry that does not fit
+ * the segment moves on to a new one, one larger than @a segment_size if it
+ * has to be. Only one thread may write to a log.
+ *
+ * \return
+ *       0 success
+ *       1 the next segment could not be created, the log stops
+ */
+int acs_record_put(struct acs_record *self, uint32_t conn, uint32_t dir, uint32_t type, const void *payload, size_t size);
+
+#endif // ACS_RECORD_H
@@ -0,0 +1,573 @@
+"""
+Host-local relay, many local clients over one upstream connection
+"""
+
+import collections
+import os
+import selectors
+import socket
+import struct
+import sys
+import time
+from typing import Deque, Dict, List, Optional, Tuple, Union
+
+from acs_sync import (FEATURE_DELTA, FRAME_CHANNEL, FRAME_DELTA, FRAME_HELLO, FRAME_MAX, FRAME_MESSAGES,
+                      FRAME_SCHEMA, FRAME_SNAPSHOT, FRAME_STATE, FRAME_STATES, FRAME_UIDS, PROTOCOL_VERSION,
+                      Connection, Outbox, _arg_check, _arg_get, clock_us, delta_decode, delta_encode, frame,
+                      frame_channel)
+
+RETRY_S = 1.0 # wait before dialing the server again
+CLOCK_SAMPLES = 8 # the server's clock comes from the quickest of this many round trips, like acs_sync.c
+
+# a slot whose entity left, sent empty once so the server frees its UID
+DRAIN = object()
+
+# sender, to, bytes; a sender still here is a Local, its UID may change
+Message = Tuple[Union["Local", int], int, bytes]
+
+##
+# One client on this host, speaking the framed protocol to us as if we were
+# the server
+class Local:
+    def __init__(self, sock: socket.socket, queue_max: int):
+        self.sock: socket.socket = sock
+        # for its flatsize and to frame what we send it
+        self.conn: Connection = Connection(0)
+        self.out: Outbox = Outbox(sock, queue_max)
+        self.inbuf: bytearray = bytearray()
+        # STATE payloads of its entities, the relay's slot of each
+        self.entities: List[bytes] = []
+        self.slots: List[int] = []
+        # clock_us() when its last STATE arrived
+        self.recv_time: int = 0
+        # sent a STATE we have not answered, for want of UIDs
+        self.waiting: bool = False
+        self.told_uids: List[int] = []
+        self.inbox: List[Message] = []
+        self.gone: bool = False
+        # its UID when it left, for its messages still on their way
+        self.uid_last: int = 0
+
+##
+# Holds one connection to the server, as a client with an entity for each
+# of the local clients' entities, and serves the local clients the server's
+# snapshot plus each other from here. Channel 0 without a schema only
+class Relay:
+    def __init__(self, remote: Tuple[str, int], flatsize: int):
+        self.remote: Tuple[str, int] = remote
+        self.flatsize: int = flatsize
+        self.selector = selectors.DefaultSelector()
+        self.locals: List[Local] = []
+        # slow local clients, like the server's
+        self.slow_queue: int = 256 << 10
+        self.slow_timeout: float = 2.0
+        # smallest upload worth delta coding, 0 for never
+        self.delta_min: int = 1024
+
+        # our entities upstream, a Local and its entity index, DRAIN or free
+        self.slots: List[object] = []
+        self.slot_uids: List[int] = []
+
+        self.sock: Optional[socket.socket] = None
+        self.out: Optional[Outbox] = None
+        self.inbuf: bytearray = bytearray()
+        self.retry_at: float = 0.0
+        self.features: int = 0
+        self.hello_sent: bool = False
+        # clock_us() when the upload in flight went out, None if none is
+        self.round_start: Optional[int] = None
+        self.dirty: bool = False
+        self.state_prev: bytes = b""
+        self.snapshot_prev: bytes = b""
+        # messages for the server, those in the upload in flight
+        self.messages: Deque[Message] = collections.deque()
+        self.messages_sent: List[Message] = []
+
+        # the server's snapshot: UID: stamp and flatdata, and the records
+        # packed for each flatsize a local client asked for
+        self.records: Dict[int, Tuple[int, bytes]] = {}
+        self.packed: Dict[int, bytes] = {}
+        # (round trip, offset) of the last round trips, the server's clock
+        # is ours plus the offset of the quickest
+        self.clock: Deque[Tuple[int, int]] = collections.deque(maxlen=CLOCK_SAMPLES)
+        self.offset: int = 0
+
+    def listen(self, sock: socket.socket):
+        sock.listen()
+        sock.setblocking(False)
+        self.selector.register(sock, selectors.EVENT_READ, self.accept)
+
+    def run(self):
+        while True:
+            if self.sock is None and time.monotonic() >= self.retry_at:
+                self.dial()
+            if self.sock is not None and self.round_start is None and self.dirty:
+                self.upload()
+
+            self.flush()
+            timeout = 0.05 if self.sock is None or any(local.out.waiting() for local in self.locals) else None
+            for key, events in self.selector.select(timeout):
+                key.data(key.fileobj, events)
+
+    def flush(self):
+        for local in self.locals:
+            if local.gone:
+                continue
+            try:
+                local.out.flush()
+            except OSError:
+                self.leave(local)
+                continue
+            if local.out.behind_since is not None and time.monotonic() - local.out.behind_since > self.slow_timeout:
+                print(f"uid {self.uid(local)}: behind for {self.slow_timeout}s, disconnecting", file=sys.stderr)
+                self.leave(local)
+        self.locals = [local for local in self.locals if not local.gone]
+
+        if self.out is not None:
+            try:
+                self.out.flush()
+            except OSError:
+                self.lost()
+                return
+            self.selector.modify(self.sock, selectors.EVENT_READ | (selectors.EVENT_WRITE if self.out.waiting() else 0),
+                                 self.upstream_ready)
+
+    ##
+    # The clock of the server now
+    def server_time(self, local_time: int) -> int:
+        return local_time + self.offset
+
+    def uid(self, local: Local) -> int:
+        if local.gone:
+            return local.uid_last
+        return next((self.slot_uids[slot] for slot in local.slots if self.slot_uids[slot]), 0)
+
+
+    def accept(self, listener: socket.socket, events: int):
+        try:
+            sock, _ = listener.accept()
+        except (BlockingIOError, InterruptedError):
+            return
+        sock.setblocking(False)
+        if sock.family != getattr(socket, "AF_UNIX", None):
+            sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        local = Local(sock, self.slow_queue)
+        self.locals.append(local)
+        self.selector.register(sock, selectors.EVENT_READ, lambda sock, events: self.local_ready(local))
+
+    def local_ready(self, local: Local):
+        try:
+            chunk = local.sock.recv(65536)
+        except (BlockingIOError, InterruptedError):
+            return
+        except OSError:
+            chunk = b""
+        if not chunk:
+            self.leave(local)
+            return
+
+        local.inbuf += chunk
+        try:
+            while len(local.inbuf) >= 8:
+                ftype, size = struct.unpack_from("<II", local.inbuf)
+                if size > FRAME_MAX:
+                    raise ValueError("frame too large")
+                if len(local.inbuf) < 8 + size:
+                    break
+                payload = bytes(local.inbuf[8:8 + size])
+                del local.inbuf[:8 + size]
+                self.local_frame(local, ftype, payload)
+        except (ValueError, struct.error) as e:
+            print(f"uid {self.uid(local)}: {e}, disconnecting", file=sys.stderr)
+            self.leave(local)
+
+    def local_frame(self, local: Local, ftype: int, payload: bytes):
+        channel_id, ftype = frame_channel(ftype)
+        if ftype == FRAME_HELLO:
+            # nothing optional, the bytes only cross loopback
+            version, _, local.conn.flatsize = struct.unpack_from("<III", payload)
+            local.out.send(frame(FRAME_HELLO, struct.pack("<III", min(version, PROTOCOL_VERSION), 0, local.conn.flatsize)))
+            return
+        if local.conn.flatsize == 0:
+            raise ValueError("only framed clients are relayed")
+
+        if channel_id != 0 or ftype in (FRAME_CHANNEL, FRAME_SCHEMA):
+            raise ValueError("channels and schemas are not relayed")
+
+        if ftype == FRAME_STATE:
+            self.entities_set(local, [payload])
+        elif ftype == FRAME_STATES:
+            count, = struct.unpack_from("<I", payload)
+            offset = 4
+            entities = []
+            for _ in range(count):
+                size, = struct.unpack_from("<I", payload, offset)
+                offset += 4
+                if offset + size > len(payload):
+                    raise ValueError("short STATES")
+                entities.append(payload[offset:offset + size])
+                offset += size
+            self.entities_set(local, entities)
+        elif ftype == FRAME_MESSAGES:
+            self.local_messages(local, payload)
+        # KEY, SUBSCRIBE and RATES are for the server to act on, a local
+        # client gets everyone
+
+    ##
+    # Take a local client's entities, answer it at once unless one of them
+    # still waits for its UID
+    def entities_set(self, local: Local, entities: List[bytes]):
+        if not entities or any(not entity for entity in entities):
+            raise ValueError("empty STATES")
+        while len(local.slots) < len(entities):
+            local.slots.append(self.slot_get(local, len(local.slots)))
+        local.entities = entities
+        local.recv_time = clock_us()
+        self.dirty = True
+
+        if any(self.slot_uids[local.slots[index]] == 0 for index in range(len(entities))):
+            local.waiting = True
+        else:
+            self.answer(local)
+
+    def slot_get(self, local: Local, index: int) -> int:
+        for slot, owner in enumerate(self.slots):
+            if owner is None:
+                self.slots[slot] = (local, index)
+                return slot
+        self.slots.append((local, index))
+        self.slot_uids.append(0)
+        return len(self.slots) - 1
+
+    def local_messages(self, local: Local, payload: bytes):
+        offset = 0
+        while offset < len(payload):
+            _, to, size = struct.unpack_from("<III", payload, offset)
+            offset += 12
+            if offset + size > len(payload):
+                raise ValueError("short MESSAGES")
+            data = payload[offset:offset + size]
+            offset += size
+
+            owner = self.owner(to) if to else None
+            if owner is not None:
+                owner.inbox.append((local, to, data))
+                continue
+            # the server sends a broadcast to everyone but us
+            if to == 0:
+                for other in self.locals:
+                    if other is not local:
+                        other.inbox.append((local, 0, data))
+            self.messages.append((local, to, data))
+            self.dirty = True
+
+    def owner(self, uid: int) -> Optional[Local]:
+        for slot, slot_uid in enumerate(self.slot_uids):
+            if slot_uid == uid and isinstance(self.slots[slot], tuple):
+                return self.slots[slot][0]
+        return None
+
+    def sender(self, sender: Union[Local, int]) -> int:
+        return self.uid(sender) if isinstance(sender, Local) else sender
+
+    ##
+    # A local client's SNAPSHOT: the server's, then the other local clients'
+    # entities, stamped on the server's clock
+    def answer(self, local: Local):
+        flatsize = local.conn.flatsize
+        uids = [self.slot_uids[slot] for slot in local.slots]
+        local.waiting = False
+
+        if len(uids) > 1 and uids != local.told_uids:
+            local.out.send(local.conn.frame(FRAME_UIDS, struct.pack(f"<{len(uids)}I", *uids)))
+            local.told_uids = uids
+
+        if local.inbox:
+            local.out.send(local.conn.frame(FRAME_MESSAGES, b"".join(
+                struct.pack("<III", self.sender(sender), to, len(data)) + data for sender, to, data in local.inbox)))
+            local.inbox = []
+
+        packed = self.packed.get(flatsize)
+        if packed is None:
+            packed = self.packed[flatsize] = b"".join(
+                struct.pack("<q", stamp) + data[:flatsize].ljust(flatsize, b"\0") for stamp, data in self.records.values())
+        count = len(self.records)
+
+        records = [packed]
+        for other in self.locals:
+            if other is local or other.gone or other.waiting:
+                continue
+            stamp = struct.pack("<q", self.server_time(other.recv_time))
+            for index, entity in enumerate(other.entities):
+                uid = self.slot_uids[other.slots[index]]
+                if uid:
+                    records.append(stamp + (uid.to_bytes(4, byteorder='little') + entity[4:flatsize]).ljust(flatsize, b"\0"))
+                    count += 1
+
+        header = struct.pack("<IIqq", uids[0], count, self.server_time(local.recv_time), self.server_time(clock_us()))
+        local.out.offer([(local.conn, FRAME_SNAPSHOT, header + b"".join(records))])
+
+    ##
+    # A local client is gone, its entities leave upstream with our next upload
+    def leave(self, local: Local):
+        if local.gone:
+            return
+        local.uid_last = self.uid(local)
+        local.gone = True
+        for slot in local.slots:
+            self.slots[slot] = DRAIN
+            self.slot_uids[slot] = 0
+        self.dirty = True
+        self.selector.unregister(local.sock)
+        local.sock.close()
+
+
+    def dial(self):
+        try:
+            sock = socket.create_connection(self.remote, timeout=RETRY_S)
+        except OSError as e:
+            print(f"{self.remote[0]}:{self.remote[1]}: {e}", file=sys.stderr)
+            self.retry_at = time.monotonic() + RETRY_S
+            return
+        sock.setblocking(False)
+        sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        self.sock = sock
+        self.out = Outbox(sock, 1 << 30)
+        self.selector.register(sock, selectors.EVENT_READ, self.upstream_ready)
+        self.dirty = True
+
+    ##
+    # The server is gone, so are the UIDs it gave. The local clients wait
+    # for new ones, and messages it may not have got are sent again
+    def lost(self):
+        print(f"{self.remote[0]}:{self.remote[1]}: disconnected", file=sys.stderr)
+        self.selector.unregister(self.sock)
+        self.sock.close()
+        self.sock = None
+        self.out = None
+        self.inbuf = bytearray()
+        self.retry_at = time.monotonic() + RETRY_S
+        self.features = 0
+        self.hello_sent = False
+        self.round_start = None
+        self.state_prev = b""
+        self.snapshot_prev = b""
+        self.messages.extendleft(reversed(self.messages_sent))
+        self.messages_sent = []
+        self.records = {}
+        self.packed = {}
+        self.clock.clear()
+
+        self.slots = [owner if isinstance(owner, tuple) else None for owner in self.slots]
+        self.slot_uids = [0] * len(self.slots)
+
+    ##
+    # Send every entity in one STATES, those that left empty, after the
+    # messages whose senders have a UID
+    def upload(self):
+        if not self.hello_sent:
+            self.out.send(frame(FRAME_HELLO, struct.pack("<III", PROTOCOL_VERSION,
+                                                         FEATURE_DELTA if self.delta_min else 0, self.flatsize)))
+            self.hello_sent = True
+
+        held = collections.deque()
+        while self.messages:
+            sender, to, data = self.messages.popleft()
+            if isinstance(sender, Local) and not sender.gone and self.uid(sender) == 0:
+                held.append((sender, to, data))
+            else:
+                self.messages_sent.append((sender, to, data))
+        self.messages = held
+        if self.messages_sent:
+            self.out.send(frame(FRAME_MESSAGES, b"".join(
+                struct.pack("<III", self.sender(sender), to, len(data)) + data for sender, to, data in self.messages_sent)))
+
+        parts = [struct.pack("<I", len(self.slots))]
+        for slot, owner in enumerate(self.slots):
+            entity = owner[0].entities[owner[1]] if isinstance(owner, tuple) and owner[1] < len(owner[0].entities) else b""
+            parts.append(struct.pack("<I", len(entity)))
+            parts.append(entity)
+            if owner is DRAIN:
+                self.slots[slot] = None
+        payload = b"".join(parts)
+
+        ftype = FRAME_STATES
+        data = payload
+        if (self.features & FEATURE_DELTA) and len(payload) >= self.delta_min:
+            packed = delta_encode(payload, self.state_prev)
+            if len(packed) < len(payload):
+                ftype |= FRAME_DELTA
+                data = packed
+        if self.features & FEATURE_DELTA:
+            self.state_prev = payload
+
+        self.out.send(frame(ftype, data))
+        self.round_start = clock_us()
+        self.dirty = False
+
+    def upstream_ready(self, sock: socket.socket, events: int):
+        if not events & selectors.EVENT_READ:
+            return
+        try:
+            chunk = sock.recv(1 << 20)
+        except (BlockingIOError, InterruptedError):
+            return
+        except OSError:
+            chunk = b""
+        if not chunk:
+            self.lost()
+            return
+
+        self.inbuf += chunk
+        try:
+            while len(self.inbuf) >= 8:
+                ftype, size = struct.unpack_from("<II", self.inbuf)
+                if size > FRAME_MAX:
+                    raise ValueError("frame too large")
+                if len(self.inbuf) < 8 + size:
+                    break
+                payload = bytes(self.inbuf[8:8 + size])
+                del self.inbuf[:8 + size]
+                self.upstream_frame(ftype, payload)
+        except (ValueError, struct.error) as e:
+            print(f"{self.remote[0]}:{self.remote[1]}: {e}", file=sys.stderr)
+            self.lost()
+
+    def upstream_frame(self, ftype: int, payload: bytes):
+        channel_id, ftype = frame_channel(ftype)
+        if channel_id != 0:
+            return
+
+        if ftype == FRAME_HELLO:
+            _, self.features, _ = struct.unpack_from("<III", payload)
+
+        elif ftype == FRAME_UIDS:
+            uids = struct.unpack_from(f"<{len(payload) // 4}I", payload)
+            for slot, uid in enumerate(uids[:len(self.slots)]):
+                if isinstance(self.slots[slot], tuple):
+                    self.slot_uids[slot] = uid
+
+        elif ftype == FRAME_MESSAGES:
+            offset = 0
+            while offset + 12 <= len(payload):
+                sender, to, size = struct.unpack_from("<III", payload, offset)
+                data = payload[offset + 12:offset + 12 + size]
+                offset += 12 + size
+                for local in ([self.owner(to)] if to else self.locals):
+                    if local is not None and not local.gone:
+                        local.inbox.append((sender, to, data))
+
+        elif ftype & ~FRAME_DELTA == FRAME_SNAPSHOT:
+            if ftype & FRAME_DELTA:
+                payload = delta_decode(payload, self.snapshot_prev)
+            self.snapshot_prev = payload
+            self.snapshot(payload)
+
+    ##
+    # The round trip ended, answer whoever was waiting on it for a UID
+    def snapshot(self, payload: bytes):
+        now = clock_us()
+        _, count, recv_time, send_time = struct.unpack_from("<IIqq", payload)
+        if self.round_start is not None:
+            self.clock.append((now - self.round_start - (send_time - recv_time),
+                               (recv_time - self.round_start + send_time - now) // 2))
+            self.offset = min(self.clock)[1]
+        self.round_start = None
+        self.messages_sent = []
+
+        records = {}
+        offset = 24
+        for _ in range(count):
+            stamp, = struct.unpack_from("<q", payload, offset)
+            data = payload[offset + 8:offset + 8 + self.flatsize]
+            records[int.from_bytes(data[:4], byteorder='little')] = (stamp, data)
+            offset += 8 + self.flatsize
+        self.records = records
+        self.packed = {}
+
+        for local in self.locals:
+            if local.waiting and not local.gone and all(self.slot_uids[slot] for slot in local.slots):
+                self.answer(local)
+
+if __name__ == '__main__':
+    host = "localhost"
+    port = 9998
+    unix = None
+    remote = ("localhost", 9999)
+    size = 64
+    slow_queue = None
+    slow_timeout = None
+    delta_min = None
+
+    if _arg_check(sys.argv, "-h", "--help"):
+        print(f"""\
+{sys.argv[0]} [OPTIONS]
+
+Serve the acs_sync clients on this host over one connection to the server,
+they connect here instead. Channels and schemas are not relayed
+
+OPTIONS:
+    -r; --remote HOST:PORT: The server to relay to, default localhost:9999
+    -a; --address ADDRESS:  Specify the address local clients connect to
+    -p; --port PORT:        Specify the PORT local clients connect to, default 9998
+    -u; --unix PATH:        Also take local clients on a Unix domain socket at
+                            PATH, for acs_sync_new(PATH, ...)
+    -s; --size SIZE:        The server's max buffer SIZE
+    -q; --queue BYTES:      Count a local client as behind past BYTES unsent, default 262144
+    -l; --lag SECONDS:      Disconnect local clients behind for SECONDS, default 2
+    -z; --compress BYTES:   Delta code uploads of BYTES or more, default 1024,
+                            0 for never
+    -h; --help:             See this help
+""")
+        exit(0)
+
+    tmp = _arg_get(sys.argv, "-r", "--remote")
+    if tmp:
+        tmp_host, _, tmp_port = tmp.rpartition(":")
+        remote = (tmp_host or "localhost", int(tmp_port))
+
+    tmp = _arg_get(sys.argv, "-a", "--address")
+    if tmp: host = tmp
+
+    tmp = _arg_get(sys.argv, "-p", "--port")
+    if tmp: port = int(tmp)
+
+    tmp = _arg_get(sys.argv, "-u", "--unix")
+    if tmp: unix = tmp
+
+    tmp = _arg_get(sys.argv, "-s", "--size")
+    if tmp: size = int(tmp)
+
+    tmp = _arg_get(sys.argv, "-q", "--queue")
+    if tmp: slow_queue = int(tmp)
+
+    tmp = _arg_get(sys.argv, "-l", "--lag")
+    if tmp: slow_timeout = float(tmp)
+
+    tmp = _arg_get(sys.argv, "-z", "--compress")
+    if tmp: delta_min = int(tmp)
+
+    relay = Relay(remote, size)
+    if slow_queue is not None:
+        relay.slow_queue = slow_queue
+    if slow_timeout is not None:
+        relay.slow_timeout = slow_timeout
+    if delta_min is not None:
+        relay.delta_min = delta_min
+
+    relay.listen(socket.create_server((host, port)))
+    if unix:
+        if os.path.exists(unix):
+            os.unlink(unix)
+        listener = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        listener.bind(unix)
+        relay.listen(listener)
+
+    try:
+        relay.run()
+    except KeyboardInterrupt:
+        pass
+    finally:
+        if unix and os.path.exists(unix):
+            os.unlink(unix)
+    exit(0)
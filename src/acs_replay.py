@@ -0,0 +1,253 @@
+"""
+Replay of frame logs, see acs_sync_set_record and acs_sync.py --record
+"""
+
+import mmap
+import os
+import socket
+import struct
+import sys
+import threading
+import time
+from typing import Iterator, List, Optional, Tuple
+
+from acs_sync import (FRAME_DELTA, FRAME_HELLO, FRAME_MAX, FRAME_MESSAGES, FRAME_SNAPSHOT, FRAME_STATE,
+                      FRAME_STATES, RECORD_CLIENT, RECORD_ENTRY, RECORD_HEADER, RECORD_RECV, RECORD_SEND,
+                      RECORD_VERSION, _arg_check, _arg_get, frame, frame_channel)
+
+# time, conn, dir, type, payload
+Entry = Tuple[int, int, int, int, bytes]
+
+##
+# Origin of the log at path
+def log_origin(path: str) -> int:
+    with open(f"{path}.000000", "rb") as fp:
+        magic, version, origin, _ = struct.unpack("<4sIII", fp.read(RECORD_HEADER))
+    if magic != b"ACSL" or version != RECORD_VERSION:
+        raise ValueError(f"{path}.000000: not a version {RECORD_VERSION} log")
+    return origin
+
+##
+# Every entry of the log at path in order, only those of connection conn if
+# it is not None. A segment ends at an entry with time 0, where a writer that
+# did not stop cleanly left it, or at the end of its file
+def log_entries(path: str, conn: Optional[int] = None) -> Iterator[Entry]:
+    index = 0
+    while os.path.exists(f"{path}.{index:06d}"):
+        with open(f"{path}.{index:06d}", "rb") as fp, mmap.mmap(fp.fileno(), 0, access=mmap.ACCESS_READ) as data:
+            offset = RECORD_HEADER
+            while offset + RECORD_ENTRY <= len(data):
+                when, entry_conn, direction, ftype, size = struct.unpack_from("<QIIII", data, offset)
+                if when == 0 or size > FRAME_MAX or offset + RECORD_ENTRY + size > len(data):
+                    break
+                if conn is None or entry_conn == conn:
+                    yield when, entry_conn, direction, ftype, data[offset + RECORD_ENTRY:offset + RECORD_ENTRY + size]
+                offset += RECORD_ENTRY + ((size + 7) & ~7)
+        index += 1
+
+##
+# Channel id and type of an entry, without the delta flag
+def entry_type(entry: Entry) -> Tuple[int, int]:
+    channel_id, ftype = frame_channel(entry[3])
+    return channel_id, ftype & ~FRAME_DELTA
+
+##
+# Whether an upload entry makes the server answer, or a download entry ends
+# the answer
+def entry_ends(entry: Entry, upload: bool) -> bool:
+    channel_id, ftype = entry_type(entry)
+    if upload:
+        return channel_id == 0 and ftype in (FRAME_STATE, FRAME_STATES)
+    return channel_id == 0 and ftype == FRAME_SNAPSHOT
+
+##
+# Group one direction of a connection into round trips. Channel 0's
+# MESSAGES follow its STATE, so they stay in that round trip
+def rounds(entries: Iterator[Entry], upload: bool) -> Iterator[List[Entry]]:
+    current: List[Entry] = []
+    ended = False
+    for entry in entries:
+        if ended and not (upload and entry_type(entry) == (0, FRAME_MESSAGES)):
+            yield current
+            current = []
+            ended = False
+        current.append(entry)
+        ended = ended or entry_ends(entry, upload)
+    if current:
+        yield current
+
+def recv_exact(sock: socket.socket, size: int) -> bytes:
+    rv = bytearray()
+    while len(rv) < size:
+        chunk = sock.recv(size - len(rv))
+        if not chunk:
+            raise ConnectionError("disconnected")
+        rv += chunk
+    return bytes(rv)
+
+##
+# Read frames off sock until one that ends an upload, or a download if not
+# upload
+def recv_until(sock: socket.socket, upload: bool):
+    while True:
+        ftype, size = struct.unpack("<II", recv_exact(sock, 8))
+        if size > FRAME_MAX:
+            raise ValueError("frame too large")
+        recv_exact(sock, size)
+        if entry_ends((0, 0, 0, ftype, b""), upload):
+            return
+
+##
+# Sleeps so entries go out as far apart as they were recorded, the first
+# one now. Shared by every connection so they keep their offsets
+class Pacer:
+    def __init__(self, first: int, fast: bool):
+        self.first: int = first
+        self.fast: bool = fast
+        self.start: Optional[float] = None
+        self.lock = threading.Lock()
+
+    def wait(self, when: int):
+        if self.fast:
+            return
+        with self.lock:
+            if self.start is None:
+                self.start = time.monotonic()
+        delay = self.start + (when - self.first) / 1e6 - time.monotonic()
+        if delay > 0:
+            time.sleep(delay)
+
+##
+# Send a connection's uploads to the server at address, each round trip once
+# the server answered the one before. A HELLO after the first means the
+# client had reconnected, so we do too
+def play_server(address: Tuple[str, int], entries: Iterator[Entry], pacer: Pacer, conn: int):
+    sock = None
+    count = 0
+    start = time.monotonic()
+    try:
+        for current in rounds(entries, True):
+            if sock is not None and current[0][3] == FRAME_HELLO:
+                sock.close()
+                sock = None
+            if sock is None:
+                sock = socket.create_connection(address)
+            pacer.wait(current[0][0])
+            sock.sendall(b"".join(frame(entry[3], entry[4]) for entry in current))
+            if any(entry_ends(entry, True) for entry in current):
+                recv_until(sock, False)
+            count += 1
+    except (OSError, ValueError) as e:
+        print(f"conn {conn}: {e}", file=sys.stderr)
+    finally:
+        if sock is not None:
+            sock.close()
+    print(f"conn {conn}: {count} round trips in {time.monotonic() - start:.3f}s")
+
+##
+# Serve a connection's downloads to the clients connecting at port, each
+# round trip once the client sent its upload. A HELLO after the first means
+# the client had reconnected, so we wait for it to
+def play_client(port: int, entries: Iterator[Entry], pacer: Pacer, conn: int):
+    count = 0
+    sock = None
+    with socket.create_server(("", port)) as listener:
+        try:
+            for current in rounds(entries, False):
+                if sock is not None and current[0][3] == FRAME_HELLO:
+                    sock.close()
+                    sock = None
+                if sock is None:
+                    sock, _ = listener.accept()
+                recv_until(sock, True)
+                pacer.wait(current[0][0])
+                sock.sendall(b"".join(frame(entry[3], entry[4]) for entry in current))
+                count += 1
+        except (OSError, ValueError) as e:
+            print(f"conn {conn}: {e}", file=sys.stderr)
+        finally:
+            if sock is not None:
+                sock.close()
+    print(f"conn {conn}: {count} round trips")
+
+##
+# Connection id: (entries, first time, last time) of the log at path
+def log_summary(path: str) -> dict:
+    rv = {}
+    for when, conn, _, _, _ in log_entries(path):
+        count, first, _ = rv.get(conn, (0, when, when))
+        rv[conn] = (count + 1, first, when)
+    return rv
+
+if __name__ == '__main__':
+    server = None
+    client = None
+    fast = False
+    only = None
+
+    if len(sys.argv) < 2 or _arg_check(sys.argv, "-h", "--help"):
+        print(f"""\
+{sys.argv[0]} LOG [OPTIONS]
+
+Play back a log written by acs_sync_set_record or acs_sync.py --record,
+without -s or -c list its connections
+
+OPTIONS:
+    -s; --server HOST:PORT: Send the log's uploads to the server at HOST:PORT,
+                            every connection of a server log at once
+    -c; --client PORT:      Serve the log's downloads to a client connecting
+                            at PORT, the first connection of a server log
+    -f; --fast:             As fast as the other side answers, instead of as
+                            fast as recorded
+    -n; --connection ID:    Only play connection ID of a server log
+    -h; --help:             See this help
+""")
+        exit(0)
+
+    path = sys.argv[1]
+
+    tmp = _arg_get(sys.argv, "-s", "--server")
+    if tmp:
+        host, _, port = tmp.rpartition(":")
+        server = (host or "localhost", int(port))
+
+    tmp = _arg_get(sys.argv, "-c", "--client")
+    if tmp: client = int(tmp)
+
+    fast = _arg_check(sys.argv, "-f", "--fast")
+
+    tmp = _arg_get(sys.argv, "-n", "--connection")
+    if tmp: only = int(tmp)
+
+    origin = log_origin(path)
+    summary = log_summary(path)
+    if only is not None:
+        summary = {conn: summary[conn] for conn in summary if conn == only}
+    if not summary:
+        print(f"{path}: no entries", file=sys.stderr)
+        exit(1)
+
+    if server is None and client is None:
+        print(f"{path}: {'client' if origin == RECORD_CLIENT else 'server'} log")
+        for conn, (count, first, last) in summary.items():
+            print(f"conn {conn}: {count} frames over {(last - first) / 1e6:.3f}s")
+        exit(0)
+
+    # what the writer sent is the upload of a client, what it received that of a server
+    upload = RECORD_SEND if origin == RECORD_CLIENT else RECORD_RECV
+
+    if server is not None:
+        pacer = Pacer(min(first for _, first, _ in summary.values()), fast)
+        threads = []
+        for conn in summary:
+            entries = (entry for entry in log_entries(path, conn) if entry[2] == upload)
+            threads.append(threading.Thread(target=play_server, args=(server, entries, pacer, conn)))
+            threads[-1].start()
+        for thread in threads:
+            thread.join()
+    else:
+        conn = next(iter(summary))
+        entries = (entry for entry in log_entries(path, conn) if entry[2] != upload)
+        play_client(client, entries, Pacer(summary[conn][1], fast), conn)
+
+    exit(0)
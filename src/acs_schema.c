@@ -0,0 +1,298 @@
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "acs_schema.h"
+
+static size_t type_size(enum acs_sync_field_type type)
+{
+    switch (type) {
+    case ACS_SYNC_I8:
+    case ACS_SYNC_U8:
+        return 1;
+    case ACS_SYNC_I16:
+    case ACS_SYNC_U16:
+        return 2;
+    default:
+        return 4;
+    }
+}
+
+static uint32_t bits_mask(unsigned bits)
+{
+    return (bits >= 32) ? 0xffffffffu : (1u << bits) - 1;
+}
+
+static void bits_put(unsigned char *dst, size_t *pos, uint32_t value, unsigned bits)
+{
+    unsigned take;
+
+    while (bits > 0) {
+        take = 8 - (unsigned)(*pos % 8);
+        if (take > bits) {
+            take = bits;
+        }
+        dst[*pos / 8] |= (unsigned char)((value & ((1u << take) - 1)) << (*pos % 8));
+        value >>= take;
+        *pos += take;
+        bits -= take;
+    }
+}
+
+static int bits_get(const unsigned char *src, size_t size, size_t *pos, unsigned bits, uint32_t *value)
+{
+    unsigned shift = 0;
+    unsigned take;
+
+    if ((*pos + bits + 7) / 8 > size) {
+        return 1;
+    }
+
+    *value = 0;
+    while (bits > 0) {
+        take = 8 - (unsigned)(*pos % 8);
+        if (take > bits) {
+            take = bits;
+        }
+        *value |= (uint32_t)((src[*pos / 8] >> (*pos % 8)) & ((1u << take) - 1)) << shift;
+        shift += take;
+        *pos += take;
+        bits -= take;
+    }
+    return 0;
+}
+
+static uint32_t quantize(const struct acs_sync_field *field, const unsigned char *data)
+{
+    const unsigned char *at = &data[field->offset];
+    uint32_t steps = bits_mask(field->bits);
+    int64_t value;
+    float f;
+    int8_t i8;
+    int16_t i16;
+    int32_t i32;
+    uint8_t u8;
+    uint16_t u16;
+    uint32_t u32;
+
+    switch (field->type) {
+    case ACS_SYNC_F32:
+        (void)memcpy(&f, at, sizeof(f));
+        // NaN lands on min
+        if (!(f > field->min)) {
+            return 0;
+        }
+        if (f >= field->max) {
+            return steps;
+        }
+        return (uint32_t)((double)(f - field->min) / (double)(field->max - field->min) * (double)steps + 0.5);
+    case ACS_SYNC_I8:  (void)memcpy(&i8, at, sizeof(i8));   value = i8;  break;
+    case ACS_SYNC_I16: (void)memcpy(&i16, at, sizeof(i16)); value = i16; break;
+    case ACS_SYNC_I32: (void)memcpy(&i32, at, sizeof(i32)); value = i32; break;
+    case ACS_SYNC_U8:  (void)memcpy(&u8, at, sizeof(u8));   value = u8;  break;
+    case ACS_SYNC_U16: (void)memcpy(&u16, at, sizeof(u16)); value = u16; break;
+    case ACS_SYNC_U32: (void)memcpy(&u32, at, sizeof(u32)); value = u32; break;
+    default:
+        assert(0);
+        return 0;
+    }
+
+    value -= (int64_t)field->min;
+    if (value < 0) {
+        return 0;
+    }
+    if (value > (int64_t)steps) {
+        return steps;
+    }
+    return (uint32_t)value;
+}
+
+static void dequantize(const struct acs_sync_field *field, uint32_t q, unsigned char *data)
+{
+    unsigned char *at = &data[field->offset];
+    int64_t value = (int64_t)field->min + q;
+    float f;
+    int8_t i8;
+    int16_t i16;
+    int32_t i32;
+    uint8_t u8;
+    uint16_t u16;
+    uint32_t u32;
+
+    switch (field->type) {
+    case ACS_SYNC_F32:
+        f = (float)(field->min + (double)q * (double)(field->max - field->min) / (double)bits_mask(field->bits));
+        (void)memcpy(at, &f, sizeof(f));
+        break;
+    case ACS_SYNC_I8:  i8 = (int8_t)value;    (void)memcpy(at, &i8, sizeof(i8));   break;
+    case ACS_SYNC_I16: i16 = (int16_t)value;  (void)memcpy(at, &i16, sizeof(i16)); break;
+    case ACS_SYNC_I32: i32 = (int32_t)value;  (void)memcpy(at, &i32, sizeof(i32)); break;
+    case ACS_SYNC_U8:  u8 = (uint8_t)value;   (void)memcpy(at, &u8, sizeof(u8));   break;
+    case ACS_SYNC_U16: u16 = (uint16_t)value; (void)memcpy(at, &u16, sizeof(u16)); break;
+    case ACS_SYNC_U32: u32 = (uint32_t)value; (void)memcpy(at, &u32, sizeof(u32)); break;
+    default:
+        assert(0);
+        break;
+    }
+}
+
+int acs_schema_check(const struct acs_sync_field *fields, size_t count, size_t flatsize)
+{
+    size_t i;
+    size_t size;
+
+    if (!fields || count == 0) {
+        return 1;
+    }
+
+    for (i = 0; i < count; i++) {
+        if (fields[i].type > ACS_SYNC_BYTES) {
+            return 1;
+        }
+
+        if (fields[i].type == ACS_SYNC_BYTES) {
+            size = fields[i].size;
+            if (size == 0) {
+                return 1;
+            }
+        }
+        else {
+            size = type_size(fields[i].type);
+            if (fields[i].bits == 0 || fields[i].bits > 32) {
+                return 1;
+            }
+        }
+
+        if (fields[i].type == ACS_SYNC_F32 &&
+            !(isfinite(fields[i].min) && isfinite(fields[i].max) && fields[i].min < fields[i].max))
+        {
+            return 1;
+        }
+
+        // the uid always goes as it is
+        if (fields[i].offset < sizeof(uint32_t) || fields[i].offset + size > flatsize) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+unsigned acs_schema_field_bits(const struct acs_sync_field *field)
+{
+    assert(field);
+    return (field->type == ACS_SYNC_BYTES) ? (unsigned)(field->size * 8) : field->bits;
+}
+
+size_t acs_schema_bound(const struct acs_sync_field *fields, size_t count)
+{
+    size_t bits = count;
+    size_t i;
+
+    assert(fields);
+
+    for (i = 0; i < count; i++) {
+        bits += acs_schema_field_bits(&fields[i]);
+    }
+    return (bits + 7) / 8;
+}
+
+long acs_schema_find(const struct acs_sync_field *fields, size_t count, size_t offset)
+{
+    size_t i;
+
+    assert(fields);
+
+    for (i = 0; i < count; i++) {
+        if (fields[i].offset == offset) {
+            return (long)i;
+        }
+    }
+    return -1;
+}
+
+size_t acs_schema_encode(const struct acs_sync_field *fields, size_t count, const void *data, const void *ref, void *dst)
+{
+    const unsigned char *in = data;
+    const unsigned char *old = ref;
+    unsigned char *out = dst;
+    size_t pos = count; // values follow the bit per field
+    size_t i;
+    size_t j;
+    uint32_t q;
+
+    assert(fields);
+    assert(data);
+    assert(dst);
+
+    (void)memset(out, 0, acs_schema_bound(fields, count));
+
+    for (i = 0; i < count; i++) {
+        if (fields[i].type == ACS_SYNC_BYTES) {
+            if (old && memcmp(&in[fields[i].offset], &old[fields[i].offset], fields[i].size) == 0) {
+                continue;
+            }
+            out[i / 8] |= (unsigned char)(1 << (i % 8));
+            for (j = 0; j < fields[i].size; j++) {
+                bits_put(out, &pos, in[fields[i].offset + j], 8);
+            }
+        }
+        else {
+            q = quantize(&fields[i], in);
+            if (old && q == quantize(&fields[i], old)) {
+                continue;
+            }
+            out[i / 8] |= (unsigned char)(1 << (i % 8));
+            bits_put(out, &pos, q, fields[i].bits);
+        }
+    }
+
+    return (pos + 7) / 8;
+}
+
+int acs_schema_decode(const struct acs_sync_field *fields, size_t count, const void *src, size_t size, void *data, size_t *used)
+{
+    const unsigned char *in = src;
+    unsigned char *out = data;
+    size_t pos = count;
+    size_t i;
+    size_t j;
+    uint32_t q;
+
+    assert(fields);
+    assert(src || size == 0);
+    assert(used);
+
+    if ((count + 7) / 8 > size) {
+        return 1;
+    }
+
+    for (i = 0; i < count; i++) {
+        if ((in[i / 8] & (1 << (i % 8))) == 0) {
+            continue;
+        }
+
+        if (fields[i].type == ACS_SYNC_BYTES) {
+            for (j = 0; j < fields[i].size; j++) {
+                if (bits_get(in, size, &pos, 8, &q) != 0) {
+                    return 1;
+                }
+                if (out) {
+                    out[fields[i].offset + j] = (unsigned char)q;
+                }
+            }
+        }
+        else {
+            if (bits_get(in, size, &pos, fields[i].bits, &q) != 0) {
+                return 1;
+            }
+            if (out) {
+                dequantize(&fields[i], q, out);
+            }
+        }
+    }
+
+    *used = (pos + 7) / 8;
+    return 0;
+}
@@ -0,0 +1,58 @@
+#ifndef ACS_SCHEMA_H
+#define ACS_SCHEMA_H
+
+/**
+ * Records packed by a schema, see acs_sync_set_schema.
+ *
+ * A coded record is a bit stream, least significant bit first: one bit per
+ * field telling whether it follows, then the fields that do in schema
+ * order, each in its number of bits, padded to a whole byte. A field is
+ * left out when its quantized value equals the one in the reference, the
+ * flatdata the receiver already has. acs_sync.py has the same layout for
+ * the server.
+ */
+
+#include <stddef.h> // size_t
+
+#include "acs_sync.h"
+
+/**
+ * Return 0 if @a count @a fields fit a flatdata of @a flatsize and are well
+ * formed, 1 otherwise
+ */
+int acs_schema_check(const struct acs_sync_field *fields, size_t count, size_t flatsize);
+
+/**
+ * Bits @a field takes on the wire
+ */
+unsigned acs_schema_field_bits(const struct acs_sync_field *field);
+
+/**
+ * Most bytes acs_schema_encode writes
+ */
+size_t acs_schema_bound(const struct acs_sync_field *fields, size_t count);
+
+/**
+ * Index of the field at @a offset, -1 if there is none
+ */
+long acs_schema_find(const struct acs_sync_field *fields, size_t count, size_t offset);
+
+/**
+ * Code the fields of @a data that differ from @a ref, or all of them if @a ref
+ * is NULL, into @a dst which must hold acs_schema_bound bytes. Returns the
+ * coded size
+ */
+size_t acs_schema_encode(const struct acs_sync_field *fields, size_t count, const void *data, const void *ref, void *dst);
+
+/**
+ * Decode a record from the @a size bytes at @a src into the fields of
+ * @a data, leaving the others as they are. @a data may be NULL to skip the
+ * record. Stores the bytes the record took in @a used.
+ *
+ * \return
+ *       0 success
+ *       1 the record runs past @a size
+ */
+int acs_schema_decode(const struct acs_sync_field *fields, size_t count, const void *src, size_t size, void *data, size_t *used);
+
+#endif // ACS_SCHEMA_H
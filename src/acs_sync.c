@@ -41,8 +41,8 @@
 
 #include <assert.h>
 #include <stdint.h>
-#include <math.h>
 #include <memory.h>
+#include <stdio.h>
 
 // millisleep util
 #if defined(WIN32)
@@ -55,22 +55,130 @@
 
 #include <tinycthread.h>
 
+#include "acs_delta.h"
+#include "acs_record.h"
+#include "acs_schema.h"
 #include "acs_sync.h"
+#include "acs_trace.h"
 #include "list.h"
 
 /*
  * Macros
  */
 
-// array of bytes, and the bit position from the start, ie 17 is byte:2 bit:1
-#define BIT_SET(BYTE_POINTER, BITNO) \
-    do { \
-        ((BYTE_POINTER)[(BITNO) / 8]) |= (1 << ((BITNO) % 8)); \
-    } while (0)
+/*
+ * Wire Protocol
+ *
+ * Everything is framed as a struct frame followed by frame.size bytes, with
+ * integers in host byte order (little-endian everywhere we run, the server
+ * packs them that way). Each round trip the client sends a STATE frame,
+ * preceded by a HELLO on a fresh connection, and the server answers with a
+ * SNAPSHOT, preceded by its own HELLO if it got one. Frames of an unknown
+ * type are skipped so either side may add more.
+ *
+ * Once both HELLOs carry FEATURE_DELTA, STATE and SNAPSHOT frames at least
+ * as big as the sender's threshold may be delta coded against the previous
+ * frame of their type on that connection, see acs_delta.h. Such frames have
+ * FRAME_DELTA set in their type, and only when that made them smaller.
+ *
+ * With FEATURE_SIZED, our STATE is only as long as acs_sync_write_size said
+ * and SNAPSHOT records carry a uint32_t size before their flatdata.
+ *
+ * With a schema, sent in a SCHEMA frame after the HELLO, flatdata in STATE
+ * and in SNAPSHOT records is a uint32_t uid then the fields coded against
+ * what the other side last got on this connection, see acs_schema.h.
+ *
+ * A client with several entities sends STATES instead of STATE, and the
+ * server answers with the UIDs it gave them in a UIDS frame. An empty entity
+ * has left, the server frees its UID and gives the next one there a new one,
+ * which only acs_relay.py does since its local clients come and go.
+ *
+ * Channels share the connection, each with its own UIDs and flatsize on the
+ * server. Every type but HELLO carries a channel id in the bits at
+ * FRAME_CHANNEL_SHIFT, 0 being the connection's own. A channel opens with a
+ * CHANNEL frame and otherwise speaks like a connection of its own, with its
+ * own dictionaries, all within the one round trip: we send the channels'
+ * frames before ours and the server answers in the same order, so channel 0's
+ * SNAPSHOT still ends it.
+ *
+ * MESSAGES go both ways outside the state: ours after our STATE, so we have
+ * a UID to send them from, the server's to us before our SNAPSHOT, never dropped like a SNAPSHOT may be.
+ * Ours are sent again each round trip until one ends, so they survive a
+ * reconnect, and the server may get some twice if it broke just after.
+ *
+ * Servers of a federation talk among themselves with FEATURE_PEER in their
+ * HELLO, which clients never send. They trade MESSAGES and PEER frames, 13,
+ * holding the key, age and flatdata of each client they know of.
+ *
+ * With FEATURE_MULTICAST, a server that has a multicast group publishes a
+ * SNAPSHOT of everyone on channel 0 to it each tick, as datagrams of a
+ * struct multicast_part then up to MULTICAST_PART bytes. Its header has no
+ * UID or recv_time and its records are sized. In place of our SNAPSHOT the
+ * server then sends a TICK, naming the last tick it published and filling in
+ * the rest of the header. When that tick has not arrived whole, we send a
+ * REPAIR before our next STATE and get a SNAPSHOT over TCP for it.
+ *
+ * Times on the wire are the server's clock in microseconds.
+ */
+
+#define PROTOCOL_VERSION 2
+
+#define FRAME_HELLO 0x32534341 // "ACS2", always first so it doubles as the magic
+#define FRAME_STATE 2          // our flatdata
+#define FRAME_SNAPSHOT 3       // struct snapshot, then obj_count records
+#define FRAME_KEY 4            // uint32_t offset of the float[2] position in our flatdata,
+                               // or with a schema the uint32_t indexes of its x and y fields
+#define FRAME_SUBSCRIBE 5      // struct subscribe, then uid_count uint32_t UIDs
+#define FRAME_RATES 6          // struct rates, then uid_count struct rate
+#define FRAME_KEEP 7           // uint32_t UIDs left out of the next SNAPSHOT but still there
+#define FRAME_SCHEMA 8         // uint32_t field count, then that many struct wire_field
+#define FRAME_STATES 9         // uint32_t count, then each entity's uint32_t size and STATE payload
+#define FRAME_UIDS 10          // uint32_t UIDs of our entities, in order
+#define FRAME_CHANNEL 11       // uint32_t flatsize of the channel it is on
+#define FRAME_MESSAGES 12      // struct message then its bytes, as many as fit
+#define FRAME_TICK 14          // struct tick, in place of our SNAPSHOT with FEATURE_MULTICAST
+#define FRAME_REPAIR 15        // empty, answer this round trip with a SNAPSHOT after all
+#define FRAME_CHANNEL_SHIFT 16 // channel id in bits 16 to 30 of every type but HELLO
+#define FRAME_CHANNEL_MAX 0x7fff
+#define FRAME_DELTA 0x80000000u // set in the type of a delta coded frame
+
+// hello.features
+#define FEATURE_DELTA 0x1
+#define FEATURE_SIZED 0x2
+#define FEATURE_MULTICAST 0x8 // 0x4 is FEATURE_PEER, between servers
+
+#define MULTICAST_MAGIC 0x4d534341 // "ACSM", starts every datagram
+#define MULTICAST_PART 1200        // SNAPSHOT bytes per datagram, so one fits an Ethernet frame
+#define MULTICAST_WAIT_MS 50       // longest wait for the tick a TICK names, then it is repaired
+
+// settings the server keeps per connection, resent when they change or we reconnect
+#define DIRTY_SUBSCRIBE 0x1
+#define DIRTY_RATES 0x2
+
+#define FRAME_MAX (64 * 1024 * 1024) // anything bigger is a broken stream
+
+#define CLOCK_SAMPLES 8 // clock offset comes from the best of this many round trips
+
+/*
+ * Groups
+ *
+ * A group's thread takes each of its sessions thru the steps thread_func
+ * blocks in, polling the sockets of those waiting on the server, and
+ * checking the barriers of those waiting on their main thread.
+ */
+
+#define STEP_WAIT_WRITE 0 // for acs_sync_write to release the barrier
+#define STEP_SEND 1       // holding the barrier, to send the upload
+#define STEP_RECV 2       // for frames up to our SNAPSHOT
+#define STEP_WAIT_READ 3  // for acs_sync_read_next to release the barrier
+
+#define GROUP_SPIN_MS 1        // poll timeout while a barrier may be released any time
+#define GROUP_IDLE_MS 100      // poll timeout otherwise, so acs_sync_group_del is noticed
+#define GROUP_RETRY_US 10000   // wait before sending again after an error, like thread_func
+#define GROUP_RECV_MIN 4096    // least room to recv into
+#define GROUP_RING_BUFFERS 4   // io_uring recv buffers of GROUP_RECV_MIN per session, see acs_ring_new
 
-// just check if the bit is set
-#define BIT_TEST(BYTE_POINTER, BITNO) \
-    ((BYTE_POINTER)[(BITNO) / 8] & (1 << ((BITNO) % 8)))
+#define ZEROCOPY_WAIT_MS 1000 // longest wait for the kernel to let go of a tx, then the connection is dropped
 
 /*
  * Data Types
@@ -81,8 +189,127 @@ struct send_data {
     size_t flatsize;
 };
 
+struct frame {
+    uint32_t type; // FRAME_*
+    uint32_t size; // bytes that follow
+};
+
+struct hello {
+    uint32_t version;
+    uint32_t features; // optional features requested by the client, accepted by the server
+    uint32_t flatsize;
+};
+
+struct snapshot {
+    uint32_t uid;       // this user's unique ID
+    uint32_t obj_count; // the number of records that follow
+    int64_t recv_time;  // when the server received our STATE
+    int64_t send_time;  // when the server sent this SNAPSHOT
+};
+// each record is an int64_t of when the server received it, then flatdata
+// with FEATURE_SIZED, the flatdata is preceded by its uint32_t size
+
+struct tick {
+    uint32_t uid;       // like struct snapshot
+    uint32_t tick;      // the last tick published, apply it or a newer one
+    int64_t recv_time;
+    int64_t send_time;
+};
+
+struct multicast_part {
+    uint32_t magic;     // MULTICAST_MAGIC
+    uint32_t tick;      // which SNAPSHOT it is part of, counting from 1
+    uint32_t index;     // it holds the bytes from index * MULTICAST_PART
+    uint32_t size;      // bytes of the whole SNAPSHOT payload
+};
+
+struct subscribe {
+    uint32_t has_region; // whether min/max are meaningful
+    float min[2];
+    float max[2];
+    uint32_t uid_count;  // no region and no UIDs means everyone
+};
+
+struct wire_field {
+    uint32_t type; // enum acs_sync_field_type
+    uint32_t bits; // acs_schema_field_bits
+    float min;
+    float max;
+};
+
+struct rates {
+    struct acs_sync_rates classes;
+    uint32_t uid_count;
+};
+
+struct rate {
+    uint32_t uid;
+    uint32_t period;
+};
+
+struct message {
+    uint32_t from; // UID of the sender's first entity, the server fills it in
+    uint32_t to;   // UID it is for, 0 for everyone else on the channel
+    uint32_t size; // bytes that follow
+};
+
+struct buffer {
+    char *data;
+    size_t size;     // bytes in use
+    size_t capacity; // bytes allocated
+};
+
+struct peer {
+    struct dlist_node link; // in recv_data while the peer is there
+    uint64_t seen;        // the connection's generation when a SNAPSHOT or KEEP last held it
+    uint64_t stamp;       // acs_time_us when the server received this record
+    uint64_t size;        // bytes of data the record held
+    uint32_t history_next;  // entry of its ring the next record goes to
+    uint32_t history_count; // records in its ring, up to history_depth
+    unsigned char data[]; // flatdata, room for flatsize bytes
+};
+
+struct history_entry {
+    int64_t stamp;        // acs_time_us on the server's clock, so a new clock_offset cannot reorder it
+    uint64_t size;
+    unsigned char data[];
+};
+
+struct group_worker {
+    struct acs_sync_group *group;
+    thrd_t thread;
+    struct acs_sync **syncs;      // the sessions this thread runs
+    size_t sync_count;
+    struct acs **socks;           // scratch for acs_poll, one per session
+    struct acs_sync **polled;     // whose each of socks is
+    unsigned char *readable;
+    void *poll_scratch;           // acs_poll_size of every session
+    struct acs_ring *ring;        // batches every session's IO when io_uring is there, NULL to poll
+};
+
+struct acs_sync_group {
+    struct acs_sync **syncs;
+    size_t sync_count;
+    struct group_worker *workers;
+    size_t worker_count;
+    size_t running;               // workers with a thread
+    size_t thread_max;
+    volatile int done;            // exit flag
+};
+
+struct clock_sample {
+    int64_t offset; // server clock minus ours
+    int64_t delay;  // round trip minus the server's time holding our STATE
+};
+
 struct acs_sync {
-    struct acs *sock;             // actual cannibal socket man
+    struct acs *sock;             // actual cannibal socket man, NULL for a channel
+
+    // channels, see acs_sync_new_channel
+    struct acs_sync *conn;        // who owns the socket and thread, ourselves unless we are a channel
+    uint32_t channel;             // our channel id, 0 for the connection
+    struct acs_sync **channels;   // with conn == self, the channels riding on us
+    size_t channel_count;
 
     enum acs_sync_state state;    // pollable item, RDONLY from main, WRONLY for network
     int thread_done;              // exit flag
@@ -92,15 +319,111 @@ struct acs_sync {
     mtx_t mutex_barrier;
     struct send_data data_main;   // version from main thread
     struct send_data data_thread; // local copy for thread to have
+    size_t write_size;            // bytes of data_thread to send
+    size_t entity_count;          // flatdata records in data_main and data_thread
+    int sized;                    // whether to ask for FEATURE_SIZED
+
+    // wire buffers
+    struct buffer tx;             // frames for the current send
+    struct buffer tx_spare;       // the other tx, sends alternate between them while zerocopy is on
+    uint64_t tx_mark;             // acs_zerocopy_mark after tx was sent
+    uint64_t tx_spare_mark;       // same for tx_spare
+    struct buffer rx;             // payload of the last frame received
+    uint64_t rx_time;             // acs_time_us when that frame began to arrive
+    uint64_t round_start;         // acs_time_us when this round trip's upload was sent
+    uint32_t features;            // what the server accepted in its HELLO
+
+    // delta coding, the dictionaries only last as long as the connection
+    size_t delta_min;             // smallest STATE to code, 0 to not ask for FEATURE_DELTA
+    struct buffer tx_prev;        // last STATE payload sent
+    struct buffer rx_prev;        // last SNAPSHOT payload received
+    struct buffer unpacked;       // a coded frame's payload is decoded here, then swapped with rx
+
+    // schema, see acs_sync_set_schema
+    struct acs_sync_field *schema;
+    size_t schema_count;          // 0 for no schema
+    struct buffer packed;         // our STATE coded by the schema, or our STATES
+    void *state_ref;              // each entity's flatdata as the server last got it
+    int state_ref_valid;          // whether the server has any since connecting
+
+    // interest, written by the main thread before the write barrier is released
+    long key_offset;              // offset of our float[2] position, -1 for none
+    uint32_t *sub_uids;           // client_max UIDs we subscribed to
+    size_t sub_count;
+    struct acs_sync_region sub_region;
+    int sub_has_region;
+
+    // update rates, written like the interest
+    struct acs_sync_rates rates;
+    uint32_t *rate_periods;       // client_max per UID periods, 0 for the class default
+    size_t rate_count;            // nonzero entries in rate_periods
+    int rates_set;                // whether to send RATES at all
+
+    unsigned dirty;               // DIRTY_* the server has not seen yet
+
+    // messages, see acs_sync_send_message
+    struct buffer msg_out;        // written by the main thread before the write barrier is released
+    struct buffer msg_sent;       // taken from msg_out, sent each round trip until one ends
+    struct buffer msg_in;         // MESSAGES payloads not read yet, see acs_sync_read_message
+    size_t msg_cursor;            // where the main thread reads msg_in next
 
     // recv data
-    struct list *recv_data;       // list holding all other clients' data
-    struct node **cursor_main;    // the cursor the main thread uses during an acs_sync_read_next
-
-    // record who is connected in a bitmap, set means connected
-    unsigned char *client_bitmap; // use a bitmap to remember which clients are connected
-    size_t client_bitmap_size;    // size in bytes client_bitmap is
-    size_t client_max;            // max number of clients for client_bitmap to hold
+    struct dlist recv_data;       // list holding all other clients' struct peer
+    unsigned char *peers;         // client_max struct peer, one per UID, so records need no malloc
+    size_t peer_stride;           // bytes from one struct peer to the next
+    struct dlist_node *cursor_main; // the cursor the main thread uses during an acs_sync_read_next
+    unsigned char *history;       // client_max rings of history_depth struct history_entry, see acs_sync_set_history
+    size_t history_depth;         // 0 for no history
+    size_t history_stride;        // bytes from one struct history_entry to the next
+
+    // who is connected, recv_data is kept in the order peers were last seen
+    uint64_t generation;          // round trips the connection started
+    uint32_t *joined;             // client_max UIDs that appeared this round trip
+    size_t joined_count;
+    uint32_t *left;               // client_max UIDs that went away this round trip
+    size_t left_count;
+    uint32_t *modified;           // client_max UIDs whose data changed this round trip, not joined
+    size_t modified_count;
+    unsigned char *peer_prev;     // flatsize, a peer's data before a schema record goes over it
+    size_t change_cursor;         // how far acs_sync_read_changed got into joined, modified, left
+    size_t client_max;            // max number of clients, UIDs are below it
+
+    // statistics, the thread counts into stats and publishes into stats_shared
+    struct acs_sync_stats stats;
+    struct acs_sync_stats stats_shared;
+    mtx_t mutex_stats;            // held only to copy stats_shared in or out
+    int connected;                // a send has succeeded since the last error
+
+    // clock synchronization, see clock_update
+    struct clock_sample clock_samples[CLOCK_SAMPLES];
+    size_t clock_count;           // samples taken since connecting
+    int64_t clock_offset;         // server clock minus ours
+
+    // when a group runs us instead of a thread of our own, see acs_sync_group_add
+    int grouped;
+    int step;                     // STEP_* the group's thread is at with us
+    uint64_t wait_start;          // acs_time_us when the current barrier wait began
+    uint64_t retry_at;            // acs_time_us before which not to send again
+    uint64_t tx_held_at;          // acs_time_us since the kernel has held both tx buffers, 0 if it does not
+    struct buffer inbox;          // bytes received but not framed yet
+    size_t inbox_pos;             // where the next frame starts in inbox
+    struct acs_ring *ring;        // our worker's, NULL unless it has one
+
+    struct acs_record *record;    // frames sent and received, see acs_sync_set_record, NULL for none
+
+    // multicast, see acs_sync_set_multicast
+    struct acs_multicast *multicast; // NULL to get every SNAPSHOT over TCP
+    struct buffer multicast_build;   // SNAPSHOT of the tick whose parts are arriving
+    struct buffer multicast_have;    // a byte per part of it, whether it arrived
+    uint32_t multicast_tick;         // that tick, 0 for none
+    size_t multicast_missing;        // its parts not arrived yet
+    struct buffer multicast_done;    // SNAPSHOT of the newest tick that arrived whole
+    uint32_t multicast_done_tick;    // its tick, 0 for none
+    int repair;                      // a tick was missed, ask for a SNAPSHOT
+
+#ifdef ACS_TRACE
+    struct acs_trace *trace;      // phases of thread_func, only the thread records
+#endif
 };
 
 /*
@@ -108,8 +431,51 @@ struct acs_sync {
  */
 
 static int millisleep(unsigned ms); // sleep during a retry to space out attempts
-static int data_cmp(void *value, void *query); // compare client UIDs
 static int thread_func(void *client); // network thread func
+static void uid_reset(struct acs_sync *self); // forget our UID after an error
+static void state_set(struct acs_sync *self, enum acs_sync_state state); // ours, then our channels'
+static void barrier_release(struct acs_sync *self); // let the network thread go on
+static struct acs_sync *sync_alloc(size_t max_clients, void *flatdata, size_t flatsize, size_t count); // all but the connection
+static void sync_free(struct acs_sync *self); // undo sync_alloc
+static void stats_publish(struct acs_sync *self); // make stats visible to acs_sync_get_stats
+static void buffer_init(struct buffer *self, size_t capacity);
+static void buffer_free(struct buffer *self);
+static void buffer_reserve(struct buffer *self, size_t capacity);
+static char *buffer_frame(struct buffer *self, uint32_t type, const void *payload, size_t size); // append a frame
+static char *frame_put(struct acs_sync *self, uint32_t type, const void *payload, size_t size); // append a frame on our channel
+static void buffer_set(struct buffer *self, const void *data, size_t size); // replace the contents
+static size_t state_pack(struct acs_sync *self, size_t entity, char *dst); // one entity by the schema into dst
+static void state_frame(struct acs_sync *self); // append our STATE or STATES, delta coded if it pays
+static void uids_apply(struct acs_sync *self); // rx UIDS into our entities
+static void schema_frames(struct acs_sync *self); // append SCHEMA and the KEY that goes with it
+static void channel_upload(struct acs_sync *self); // a channel's frames into its connection's tx
+static int messages_apply(struct acs_sync *self); // rx MESSAGES into msg_in, 0 on success
+static void upload_build(struct acs_sync *self); // frames for this round trip into tx
+static enum acs_code frame_recv(struct acs_sync *self, struct frame *frame, struct acs_sync **channel); // next frame's payload into rx
+static enum acs_code frame_unpack(struct acs_sync *self, struct frame *frame, struct acs_sync **channel); // route and decode the frame in rx
+static void record_upload(struct acs_sync *self); // log each frame in tx
+static int tx_release(struct acs_sync *self, int timeout_ms); // make sure the kernel is done with tx, 0 once it is, 1 if it still holds both
+static int round_send(struct acs_sync *self); // build and send this round trip's upload, 0 on success
+static int frame_apply(struct acs_sync *self, struct frame *frame, struct acs_sync *channel); // act on the frame in rx
+static void group_fail(struct acs_sync *self); // reset after an error, as thread_func does
+static int group_step(struct acs_sync *self); // take one session as far as it goes without blocking, 1 if it waits on its main thread
+static void group_recv(struct acs_sync *self); // recv what a readable session has and act on its frames
+static void group_frames(struct acs_sync *self, size_t received); // act on the frames in inbox, received bytes longer now
+static void group_ring(struct group_worker *worker, int timeout_ms); // submit the sends and act on what the ring got
+static int group_func(void *arg); // group network thread func
+static void clock_update(struct acs_sync *self, int64_t t0, int64_t t1, int64_t t2, int64_t t3); // NTP style offset
+static struct peer *peer_get(struct acs_sync *self, uint32_t uid); // find or add the peer with uid
+static int snapshot_apply(struct acs_sync *self, uint64_t sent, int shared); // rx SNAPSHOT into recv_data, 0 on success
+static int uid_ours(struct acs_sync *self, uint32_t uid); // whether one of our entities has uid
+static void multicast_part_put(struct acs_sync *self, const char *datagram, size_t size); // a datagram into the tick it is part of
+static void multicast_collect(struct acs_sync *self, uint32_t tick, int timeout_ms); // take datagrams until tick or a newer one is whole
+static int tick_apply(struct acs_sync *self); // rx TICK, 0 applied, 1 missed, -1 on garbage
+static void keep_apply(struct acs_sync *self); // rx KEEP, those peers are still there
+static void peer_seen(struct acs_sync *self, struct peer *peer); // stamp it with this round trip
+static void peers_prune(struct acs_sync *self); // drop clients the round trip did not hold
+static struct history_entry *history_at(struct acs_sync *self, uint32_t uid, size_t age); // age 0 is the newest
+static void history_push(struct acs_sync *self, uint32_t uid, struct peer *peer, int64_t stamp); // keep what the peer holds now, server stamped
+static void sample_set(struct acs_sync *self, struct acs_sync_sample *sample, const struct history_entry *entry); // point at an entry, stamped on our clock
 
 /*
  * Static Variables
@@ -117,6 +483,10 @@ static int thread_func(void *client); // network thread func
 
 static int initialized = 0;
 
+#ifdef ACS_TRACE
+static unsigned trace_tid = 0; // distinguishes each network thread in a dump
+#endif
+
 /*
  * Static Function Definitions
  */
@@ -158,329 +528,2074 @@ static int millisleep(unsigned ms)
 #endif
 }
 
-static int data_cmp(void *value, void *query)
+static void uid_reset(struct acs_sync *self)
 {
-    /*
-     * value and query both MUST contain flatdata, so it starts with
-     * a uint32_t uid
-     */
-
-    return ((*(uint32_t *)value) == (*(uint32_t *)query)) ? 0 : 1;
+    struct acs_sync *channel;
+    size_t i;
+    size_t j;
+
+    // the server hands out a channel's UIDs again along with ours
+    for (j = 0; j <= self->channel_count; j++) {
+        channel = (j < self->channel_count) ? self->channels[j] : self;
+        for (i = 0; i < channel->entity_count; i++) {
+            *(uint32_t *)((char *)channel->data_main.flatdata + i * channel->data_main.flatsize) = 0;
+        }
+    }
+    self->connected = 0;
+    self->clock_count = 0;
+    self->stats.uid_resets++;
 }
 
-static int thread_func(void *client)
+static void state_set(struct acs_sync *self, enum acs_sync_state state)
 {
-    struct {
-        uint32_t uid;       // this user's unique ID
-        uint32_t obj_count; // the number of objects to receive
-    } header;
+    size_t i;
 
-    uint32_t uid;
-    struct node *tmp;
-    struct node **cursor;
-    enum acs_code code;
-    struct acs_sync *self;
-    void *buf; // only lock main thread to copy from shared region to here
+    // the main thread polls the connection, so its channels must be ready first
+    for (i = 0; i < self->channel_count; i++) {
+        self->channels[i]->state = state;
+    }
+    self->state = state;
+}
 
-    assert(initialized);
-    assert(client);
+static void barrier_release(struct acs_sync *self)
+{
+    size_t i;
 
-    self = client;
-    buf = malloc(self->data_thread.flatsize);
-    assert(buf);
+    // a channel is done once it is, the barrier belongs to its connection
+    if (self->conn != self) {
+        self->state = ACS_SYNC_BUSY;
+        return;
+    }
 
-    while (self->thread_done == 0) {
-        /*
-         * Send as acs_sync_write's counterpart
-         */
-        self->state = ACS_SYNC_WRITE; // user may begin reading THEN write
-        mtx_lock(&self->mutex_barrier);
-        (void)memcpy(buf, self->data_thread.flatdata, self->data_thread.flatsize);
+    // whatever channels were left out, their turn has passed with ours
+    for (i = 0; i < self->channel_count; i++) {
+        self->channels[i]->state = ACS_SYNC_BUSY;
+        self->channels[i]->cursor_main = NULL;
+        self->channels[i]->change_cursor = 0;
+    }
 
-        /*
-         * Upon any error, the server expects us to send before it responds, so
-         * keep trying
-         */
-    send:
-        if (self->thread_done) {
-            break;
-        }
+    // wait until the lock is locked before unlocking it
+    self->state = ACS_SYNC_BUSY; // user may not touch read/write
+    while (mtx_trylock(&self->mutex_barrier) != thrd_busy);
+    mtx_unlock(&self->mutex_barrier);
+}
 
-        // keep trying to send until success, as the server expects a send before we recv
-        while (1) {
-            // now we are free to do network IO without blocking/locking the main thread
-            code = acs_send(self->sock, buf, self->data_thread.flatsize);
+static void stats_publish(struct acs_sync *self)
+{
+    // C99 has no fences, the lock orders the copy for any main thread reading
+    mtx_lock(&self->mutex_stats);
+    self->stats_shared = self->stats;
+    mtx_unlock(&self->mutex_stats);
+}
 
-            if (self->thread_done) {
-                goto out;
-            }
+static void buffer_init(struct buffer *self, size_t capacity)
+{
+    self->data = acs_malloc(capacity);
+    assert(self->data);
+    self->size = 0;
+    self->capacity = capacity;
+}
 
-            if (code == ACS_OK) {
-                break;
-            }
+static void buffer_free(struct buffer *self)
+{
+    acs_free(self->data);
+    (void)memset(self, 0, sizeof(*self));
+}
 
-            // reset UID / wait before retrying to connect
-            *(uint32_t *)self->data_main.flatdata = 0;
-            (void)millisleep(10);
-        }
+static void buffer_reserve(struct buffer *self, size_t capacity)
+{
+    if (capacity <= self->capacity) {
+        return;
+    }
 
-        /*
-         * Recv into list for acs_sync_read_next to get
-         */
+    // sized up front, so this only happens while warming up
+    if (capacity < self->capacity * 2) {
+        capacity = self->capacity * 2;
+    }
+    self->data = acs_realloc(self->data, capacity);
+    assert(self->data);
+    self->capacity = capacity;
+}
 
-        // receive header
-        code = acs_recv(self->sock, (char *)&header, sizeof(header));
-        if (code != ACS_OK) {
-            // upon failure, reset the UID and go back to step 1: try to send to the server
-            *(uint32_t *)self->data_main.flatdata = 0;
-            goto send;
-        }
+static char *buffer_frame(struct buffer *self, uint32_t type, const void *payload, size_t size)
+{
+    struct frame frame;
+    char *dest;
 
-        if (self->thread_done) {
-            break;
-        }
+    buffer_reserve(self, self->size + sizeof(frame) + size);
 
-        // send message to uid which is READONLY from the main thread, grab first 4 bytes as UID
-        *(uint32_t *)self->data_main.flatdata = header.uid;
+    frame.type = type;
+    frame.size = (uint32_t)size;
+    (void)memcpy(&self->data[self->size], &frame, sizeof(frame));
+    dest = &self->data[self->size + sizeof(frame)];
+    self->size += sizeof(frame) + size;
 
-        // no we can fill in who is there or not locally
-        (void)memset(self->client_bitmap, 0, self->client_bitmap_size);
+    // leave it to the caller to fill in
+    if (payload) {
+        (void)memcpy(dest, payload, size);
+    }
+    return dest;
+}
 
-        // remember the data MUST start with a uint32_t unique ID for the other clients
-        // we don't care if we use 'buf' here, it is the correct size to store the data
-        for ( ; header.obj_count > 0; header.obj_count--) {
-            code = acs_recv(self->sock, buf, self->data_thread.flatsize);
-            if (code != ACS_OK) {
-                // upon failure, reset UID and go back to step 1
-                *(uint32_t *)self->data_main.flatdata = 0;
-                goto send;
-            }
+static char *frame_put(struct acs_sync *self, uint32_t type, const void *payload, size_t size)
+{
+    return buffer_frame(&self->conn->tx, type | (self->channel << FRAME_CHANNEL_SHIFT), payload, size);
+}
 
-            if (self->thread_done) {
-                goto out;
-            }
+static void buffer_set(struct buffer *self, const void *data, size_t size)
+{
+    buffer_reserve(self, size);
+    (void)memcpy(self->data, data, size);
+    self->size = size;
+}
 
-            // record who was received
-            uid = *(uint32_t *)buf; // beginning MUST be an int32_t uid
+static size_t state_pack(struct acs_sync *self, size_t entity, char *dst)
+{
+    const char *state;
+    char *ref;
+    size_t size;
 
-            // bad read
-            if (uid >= self->client_max) {
-                continue;
-            }
-            BIT_SET(self->client_bitmap, uid);
+    state = (const char *)self->data_thread.flatdata + entity * self->data_thread.flatsize;
+    ref = (char *)self->state_ref + entity * self->data_thread.flatsize;
 
-            // now we may put the data into the list
-            tmp = list_find(self->recv_data, buf, data_cmp);
+    // only the fields that changed since the server last got them
+    (void)memcpy(dst, state, sizeof(uint32_t));
+    size = sizeof(uint32_t) + acs_schema_encode(self->schema, self->schema_count,
+        state, self->state_ref_valid ? ref : NULL, &dst[sizeof(uint32_t)]);
 
-            // new client who dis
-            if (tmp == NULL) {
-                // have the node take ownership of buf and we will need to make a new buf
-                list_push_back(self->recv_data, buf);
+    (void)memcpy(ref, state, self->data_thread.flatsize);
+    return size;
+}
 
-                buf = malloc(self->data_thread.flatsize);
-                assert(buf);
+static void state_frame(struct acs_sync *self)
+{
+    struct buffer *tx = &self->conn->tx;
+    struct frame frame;
+    const char *state;
+    size_t state_size;
+    size_t record_max;
+    size_t start;
+    size_t size;
+    uint32_t type;
+    uint32_t count;
+    uint32_t record_size;
+    char *payload;
+    size_t i;
+
+    state = self->data_thread.flatdata;
+    state_size = self->write_size;
+    type = FRAME_STATE;
+
+    if (self->entity_count > 1) {
+        // every entity in one frame, each record sized so the schema can code them
+        record_max = (self->schema_count > 0)
+            ? sizeof(uint32_t) + acs_schema_bound(self->schema, self->schema_count)
+            : self->data_thread.flatsize;
+        buffer_reserve(&self->packed, sizeof(count) + self->entity_count * (sizeof(record_size) + record_max));
+
+        count = (uint32_t)self->entity_count;
+        (void)memcpy(self->packed.data, &count, sizeof(count));
+        self->packed.size = sizeof(count);
+
+        for (i = 0; i < self->entity_count; i++) {
+            payload = &self->packed.data[self->packed.size + sizeof(record_size)];
+            if (self->schema_count > 0) {
+                record_size = (uint32_t)state_pack(self, i, payload);
             }
-            // update existing client
             else {
-                // copy buf into the node's version
-                (void)memcpy(tmp->value, buf, self->data_thread.flatsize);
+                record_size = (uint32_t)self->data_thread.flatsize;
+                (void)memcpy(payload, &state[i * self->data_thread.flatsize], record_size);
             }
+            (void)memcpy(&self->packed.data[self->packed.size], &record_size, sizeof(record_size));
+            self->packed.size += sizeof(record_size) + record_size;
         }
+        self->state_ref_valid = 1;
 
-        if (self->thread_done) {
-            break;
-        }
+        state = self->packed.data;
+        state_size = self->packed.size;
+        type = FRAME_STATES;
+    }
+    else if (self->schema_count > 0) {
+        buffer_reserve(&self->packed, sizeof(uint32_t) + acs_schema_bound(self->schema, self->schema_count));
+        self->packed.size = state_pack(self, 0, self->packed.data);
+        self->state_ref_valid = 1;
 
-        // look for clients who are disconnected and delete them from the list
-        // if a client is in the recv list and their bit is not set/high, then
-        // they are disconnected
+        state = self->packed.data;
+        state_size = self->packed.size;
+    }
 
-        for (cursor = list_iter_begin(self->recv_data);
-             !list_iter_done(cursor);
-             list_iter_continue(&cursor))
-        {
-            uid = *(uint32_t *)list_iter_value(cursor);
+    if ((self->conn->features & FEATURE_DELTA) && self->delta_min > 0 && state_size >= self->delta_min) {
+        start = tx->size;
+        payload = frame_put(self, type | FRAME_DELTA, NULL, ACS_DELTA_BOUND(state_size));
+        size = acs_delta_encode(state, state_size, self->tx_prev.data, self->tx_prev.size, payload);
 
-            // client has DC'ed
-            if (BIT_TEST(self->client_bitmap, uid) == 0) {
-                tmp = *cursor;
-                list_iter_continue(&cursor);
-                list_remove(self->recv_data, tmp);
-                if (list_iter_done(cursor)) {
-                    break;
-                }
-            }
+        // too different from last time to be worth it
+        if (size >= state_size) {
+            tx->size = start;
+            frame_put(self, type, state, state_size);
+        }
+        else {
+            (void)memcpy(&frame, &tx->data[start], sizeof(frame));
+            frame.size = (uint32_t)size;
+            (void)memcpy(&tx->data[start], &frame, sizeof(frame));
+            tx->size = start + sizeof(frame) + size;
         }
-
-        // wait for user to read
-        self->state = ACS_SYNC_READ;
-        mtx_lock(&self->mutex_barrier);
+    }
+    else {
+        frame_put(self, type, state, state_size);
     }
 
-out:
-    free(buf);
-    return 0;
+    // coded or not, the server takes it as the next dictionary
+    if (self->delta_min > 0) {
+        buffer_set(&self->tx_prev, state, state_size);
+    }
 }
 
-/*
- * Public Function Definitions
- */
-
-enum acs_code acs_sync_init(void)
+static void schema_frames(struct acs_sync *self)
 {
-    enum acs_code rv;
-
-    assert(initialized == 0);
+    struct wire_field field;
+    uint32_t count;
+    uint32_t key[2];
+    long x;
+    long y;
+    size_t i;
+    char *payload;
+
+    count = (uint32_t)self->schema_count;
+    payload = frame_put(self, FRAME_SCHEMA, NULL, sizeof(count) + self->schema_count * sizeof(field));
+    (void)memcpy(payload, &count, sizeof(count));
+    payload += sizeof(count);
+
+    for (i = 0; i < self->schema_count; i++) {
+        field.type = (uint32_t)self->schema[i].type;
+        field.bits = acs_schema_field_bits(&self->schema[i]);
+        field.min = self->schema[i].min;
+        field.max = self->schema[i].max;
+        (void)memcpy(payload, &field, sizeof(field));
+        payload += sizeof(field);
+    }
 
-    rv = acs_init();
-    initialized = 1;
-    return rv;
+    // the server can only read the key out of its fields
+    if (self->key_offset >= 0) {
+        x = acs_schema_find(self->schema, self->schema_count, (size_t)self->key_offset);
+        y = acs_schema_find(self->schema, self->schema_count, (size_t)self->key_offset + sizeof(float));
+        if (x >= 0 && y >= 0 && self->schema[x].type == ACS_SYNC_F32 && self->schema[y].type == ACS_SYNC_F32) {
+            key[0] = (uint32_t)x;
+            key[1] = (uint32_t)y;
+            frame_put(self, FRAME_KEY, key, sizeof(key));
+        }
+    }
 }
 
-void acs_sync_cleanup(void)
+static void channel_upload(struct acs_sync *self)
 {
-    assert(initialized == 1);
-    acs_cleanup();
-    initialized = 0;
-}
+    struct subscribe sub;
+    struct rates rates;
+    struct rate rate;
+    uint32_t offset;
+    uint32_t flatsize;
+    uint32_t uid;
+    char *payload;
 
-struct acs_sync *acs_sync_new(const char *host, const char *port, size_t max_clients, void *flatdata, size_t flatsize)
-{
-    struct acs_sync *self;
+    // the server knows nothing of a fresh connection's channels
+    if (!self->conn->connected) {
+        self->tx_prev.size = 0;
+        self->rx_prev.size = 0;
+        self->state_ref_valid = 0;
 
-    assert(initialized);
-    assert(host);
-    assert(port);
-    assert(flatdata);
+        if (self->channel != 0) {
+            flatsize = (uint32_t)self->data_thread.flatsize;
+            frame_put(self, FRAME_CHANNEL, &flatsize, sizeof(flatsize));
+        }
 
-    self = calloc(1, sizeof(*self));
-    assert(self);
+        if (self->schema_count > 0) {
+            schema_frames(self);
+        }
+        else if (self->key_offset >= 0) {
+            offset = (uint32_t)self->key_offset;
+            frame_put(self, FRAME_KEY, &offset, sizeof(offset));
+        }
 
-    self->sock = acs_new(host, port);
-    assert(self->sock);
+        // the server forgot the rest along with the old connection
+        if (self->sub_count > 0 || self->sub_has_region) {
+            self->dirty |= DIRTY_SUBSCRIBE;
+        }
+        if (self->rates_set) {
+            self->dirty |= DIRTY_RATES;
+        }
+    }
 
-    // not doing anything
-    self->thread_done = 1;
+    if (self->dirty & DIRTY_SUBSCRIBE) {
+        (void)memset(&sub, 0, sizeof(sub));
+        sub.has_region = (uint32_t)self->sub_has_region;
+        if (self->sub_has_region) {
+            (void)memcpy(sub.min, self->sub_region.min, sizeof(sub.min));
+            (void)memcpy(sub.max, self->sub_region.max, sizeof(sub.max));
+        }
+        sub.uid_count = (uint32_t)self->sub_count;
 
-    /*
-     * send stuff
-     */
+        payload = frame_put(self, FRAME_SUBSCRIBE, NULL, sizeof(sub) + self->sub_count * sizeof(uint32_t));
+        (void)memcpy(payload, &sub, sizeof(sub));
+        (void)memcpy(&payload[sizeof(sub)], self->sub_uids, self->sub_count * sizeof(uint32_t));
+    }
 
-    mtx_init(&self->mutex_barrier, mtx_plain);
+    if (self->dirty & DIRTY_RATES) {
+        rates.classes = self->rates;
+        rates.uid_count = (uint32_t)self->rate_count;
+
+        payload = frame_put(self, FRAME_RATES, NULL, sizeof(rates) + self->rate_count * sizeof(rate));
+        (void)memcpy(payload, &rates, sizeof(rates));
+        payload += sizeof(rates);
+        for (uid = 0; uid < self->client_max; uid++) {
+            if (self->rate_periods[uid] != 0) {
+                rate.uid = uid;
+                rate.period = self->rate_periods[uid];
+                (void)memcpy(payload, &rate, sizeof(rate));
+                payload += sizeof(rate);
+            }
+        }
+    }
+    self->dirty = 0;
 
-    self->data_main.flatdata = flatdata;
-    self->data_main.flatsize = flatsize;
+    // ahead of the STATE it is about
+    if (self->repair) {
+        frame_put(self, FRAME_REPAIR, NULL, 0);
+    }
 
-    self->data_thread.flatdata = malloc(flatsize);
-    assert(self->data_thread.flatdata);
-    self->data_thread.flatsize = flatsize;
+    state_frame(self);
 
-    /*
-     * recv stuff
-     */
-    self->recv_data = list_new(free);
-    assert(self->recv_data);
-    self->cursor_main = NULL;
+    // whatever the main thread sent since, after what the server may not have yet
+    if (self->msg_out.size > 0) {
+        buffer_reserve(&self->msg_sent, self->msg_sent.size + self->msg_out.size);
+        (void)memcpy(&self->msg_sent.data[self->msg_sent.size], self->msg_out.data, self->msg_out.size);
+        self->msg_sent.size += self->msg_out.size;
+        self->msg_out.size = 0;
+    }
+    if (self->msg_sent.size > 0) {
+        frame_put(self, FRAME_MESSAGES, self->msg_sent.data, self->msg_sent.size);
+    }
+}
 
-    // just enough bits to hold all client info
-    self->client_bitmap_size = (size_t)ceil((double)max_clients / 8.0);
-    self->client_bitmap = malloc(self->client_bitmap_size);
-    assert(self->client_bitmap);
-    self->client_max = max_clients;
+static int messages_apply(struct acs_sync *self)
+{
+    const struct buffer *rx = &self->conn->rx;
+    struct message msg;
+    size_t pos;
+
+    // checked here so acs_sync_read_message can trust msg_in
+    for (pos = 0; pos < rx->size; pos += sizeof(msg) + msg.size) {
+        if (rx->size - pos < sizeof(msg)) {
+            return 1;
+        }
+        (void)memcpy(&msg, &rx->data[pos], sizeof(msg));
+        if (msg.size > rx->size - pos - sizeof(msg)) {
+            return 1;
+        }
+    }
 
-    return self;
+    buffer_reserve(&self->msg_in, self->msg_in.size + rx->size);
+    (void)memcpy(&self->msg_in.data[self->msg_in.size], rx->data, rx->size);
+    self->msg_in.size += rx->size;
+    return 0;
 }
 
-void acs_sync_del(struct acs_sync *self)
+static void upload_build(struct acs_sync *self)
 {
-    assert(initialized);
-    assert(self);
+    struct hello hello;
+    struct acs_sync *channel;
+    size_t i;
+
+    self->tx.size = 0;
+
+    // a fresh connection has to introduce itself first
+    if (!self->connected) {
+        // nothing is agreed on until the server answers this HELLO, and the
+        // features cover every channel
+        self->features = 0;
+
+        hello.version = PROTOCOL_VERSION;
+        hello.features = 0;
+        for (i = 0; i <= self->channel_count; i++) {
+            channel = (i < self->channel_count) ? self->channels[i] : self;
+            if (channel->delta_min > 0) {
+                hello.features |= FEATURE_DELTA;
+            }
+            if (channel->sized && channel->schema_count == 0) {
+                hello.features |= FEATURE_SIZED;
+            }
+        }
+        if (self->multicast && self->schema_count == 0) {
+            hello.features |= FEATURE_MULTICAST;
+        }
+        hello.flatsize = (uint32_t)self->data_thread.flatsize;
+        buffer_frame(&self->tx, FRAME_HELLO, &hello, sizeof(hello));
+    }
 
-    while (mtx_trylock(&self->mutex_barrier) != thrd_busy);
-    (void)mtx_unlock(&self->mutex_barrier);
-    if (self->thread_done == 0) {
-        self->thread_done = 1;
-        (void)thrd_join(self->thread, NULL);
+    // ours go last, so our STATE still ends the upload
+    for (i = 0; i < self->channel_count; i++) {
+        channel_upload(self->channels[i]);
     }
+    channel_upload(self);
+}
 
-    if (self->recv_data) {
-        list_free(self->recv_data);
+static enum acs_code frame_recv(struct acs_sync *self, struct frame *frame, struct acs_sync **channel)
+{
+    enum acs_code code;
+
+    code = acs_recv_all(self->sock, (char *)frame, sizeof(*frame));
+    if (code != ACS_OK) {
+        return code;
     }
+    self->rx_time = acs_time_us();
 
-    if (self->sock) {
-        acs_del(self->sock);
+    if (frame->size > FRAME_MAX) {
+        return ACS_ERROR;
     }
 
-    if (self->data_thread.flatdata) {
-        free(self->data_thread.flatdata);
+    // only grows when the server has more clients than we planned for
+    buffer_reserve(&self->rx, frame->size);
+
+    code = acs_recv_all(self->sock, self->rx.data, frame->size);
+    if (code != ACS_OK) {
+        return code;
     }
+    self->rx.size = frame->size;
+
+    return frame_unpack(self, frame, channel);
+}
+
+static enum acs_code frame_unpack(struct acs_sync *self, struct frame *frame, struct acs_sync **channel)
+{
+    struct buffer tmp;
+    struct acs_sync *target;
+    uint32_t id;
+    size_t raw_size;
+
+    self->stats.bytes_recv += sizeof(*frame) + frame->size;
 
-    if (self->client_bitmap) {
-        free(self->client_bitmap);
+    // as it came, so a replay feeds it through all of this again
+    if (self->record) {
+        (void)acs_record_put(self->record, 0, ACS_RECORD_RECV, frame->type, self->rx.data, self->rx.size);
     }
 
-    mtx_destroy(&self->mutex_barrier);
+    // which of us it is for, NULL for a channel we do not have
+    target = self;
+    if (frame->type != FRAME_HELLO) {
+        id = (frame->type >> FRAME_CHANNEL_SHIFT) & FRAME_CHANNEL_MAX;
+        frame->type &= ~((uint32_t)FRAME_CHANNEL_MAX << FRAME_CHANNEL_SHIFT);
+        target = (id == 0) ? self : (id <= self->channel_count) ? self->channels[id - 1] : NULL;
+    }
+    *channel = target;
+    if (!target) {
+        return ACS_OK;
+    }
 
-    free(self);
-}
+    if (frame->type & FRAME_DELTA) {
+        frame->type &= ~FRAME_DELTA;
+        if (frame->type != FRAME_SNAPSHOT || !(self->features & FEATURE_DELTA)) {
+            return ACS_ERROR;
+        }
+        if (acs_delta_raw_size(self->rx.data, self->rx.size, &raw_size) != 0 || raw_size > FRAME_MAX) {
+            return ACS_ERROR;
+        }
 
+        buffer_reserve(&self->unpacked, raw_size);
+        if (acs_delta_decode(self->rx.data, self->rx.size, target->rx_prev.data, target->rx_prev.size, self->unpacked.data) != 0) {
+            return ACS_ERROR;
+        }
+        self->unpacked.size = raw_size;
 
-int acs_sync_run(struct acs_sync *self)
-{
-    assert(initialized);
-    assert(self);
-    assert(self->thread_done == 1);
+        tmp = self->rx;
+        self->rx = self->unpacked;
+        self->unpacked = tmp;
+    }
 
-    if (thrd_create(&self->thread, thread_func, self) == thrd_success) {
-        self->thread_done = 0;
-        return 0;
+    // the server codes the channel's next SNAPSHOT against this one
+    if (frame->type == FRAME_SNAPSHOT && (self->features & FEATURE_DELTA)) {
+        buffer_set(&target->rx_prev, self->rx.data, self->rx.size);
     }
-    return 1;
+
+    return ACS_OK;
 }
 
-void acs_sync_write(struct acs_sync *self)
+static void record_upload(struct acs_sync *self)
 {
-    assert(initialized);
-    assert(self);
-    assert(self->state == ACS_SYNC_WRITE);
-
-    (void)memcpy(self->data_thread.flatdata, self->data_main.flatdata, self->data_thread.flatsize);
+    struct frame frame;
+    size_t pos = 0;
 
-    // wait until the lock is locked before unlocking it
-    self->state = ACS_SYNC_BUSY;
-    while (mtx_trylock(&self->mutex_barrier) != thrd_busy);
-    mtx_unlock(&self->mutex_barrier);
+    while (pos + sizeof(frame) <= self->tx.size) {
+        (void)memcpy(&frame, &self->tx.data[pos], sizeof(frame));
+        (void)acs_record_put(self->record, 0, ACS_RECORD_SEND, frame.type, &self->tx.data[pos + sizeof(frame)], frame.size);
+        pos += sizeof(frame) + frame.size;
+    }
 }
 
-void *acs_sync_read_next(struct acs_sync *self)
+static void clock_update(struct acs_sync *self, int64_t t0, int64_t t1, int64_t t2, int64_t t3)
 {
-    assert(initialized);
+    /*
+     * t0 we sent, t1 the server received, t2 the server sent, t3 we received.
+     * Like NTP, trust the sample that spent the least time in flight since
+     * its offset has the least room for asymmetric delay
+     */
+
+    struct clock_sample *sample;
+    struct clock_sample *best;
+    size_t count;
+    size_t i;
+
+    sample = &self->clock_samples[self->clock_count % CLOCK_SAMPLES];
+    sample->offset = ((t1 - t0) + (t2 - t3)) / 2;
+    sample->delay = (t3 - t0) - (t2 - t1);
+    self->clock_count++;
+
+    count = (self->clock_count < CLOCK_SAMPLES) ? self->clock_count : CLOCK_SAMPLES;
+    best = &self->clock_samples[0];
+    for (i = 1; i < count; i++) {
+        if (self->clock_samples[i].delay < best->delay) {
+            best = &self->clock_samples[i];
+        }
+    }
+
+    self->clock_offset = best->offset;
+    self->stats.clock_offset = best->offset;
+}
+
+static struct peer *peer_get(struct acs_sync *self, uint32_t uid)
+{
+    struct peer *peer;
+
+    peer = (struct peer *)&self->peers[uid * self->peer_stride];
+
+    // update existing client
+    if (dlist_linked(&peer->link)) {
+        return peer;
+    }
+
+    // new client who dis, its slot may still hold whoever had the UID before
+    (void)memset(peer, 0, self->peer_stride);
+    dlist_push_back(&self->recv_data, &peer->link);
+    self->joined[self->joined_count++] = uid;
+    return peer;
+}
+
+static void peer_seen(struct acs_sync *self, struct peer *peer)
+{
+    // the ones not seen yet gather at the head for peers_prune
+    peer->seen = self->conn->generation;
+    dlist_remove(&self->recv_data, &peer->link);
+    dlist_push_back(&self->recv_data, &peer->link);
+}
+
+static int snapshot_apply(struct acs_sync *self, uint64_t sent, int shared)
+{
+    struct acs_sync *conn = self->conn;
+    const struct buffer *rx = &conn->rx;
+    struct snapshot snap;
+    struct peer *peer;
+    const char *record;
+    const char *end;
+    size_t header_size;
+    size_t used;
+    int64_t stamp;
+    uint32_t size;
+    uint32_t cut;
+    uint32_t uid;
+    uint32_t i;
+    int sized;
+    int track;
+
+    // a stamp, the size with FEATURE_SIZED unless the schema knows it, then at least a uid.
+    // A shared SNAPSHOT, sent to everyone by multicast, is always sized
+    sized = (shared || (conn->features & FEATURE_SIZED)) && self->schema_count == 0;
+    header_size = sizeof(stamp) + (sized ? sizeof(size) : 0);
+
+    if (rx->size < sizeof(snap)) {
+        return 1;
+    }
+    (void)memcpy(&snap, rx->data, sizeof(snap));
+    if ((rx->size - sizeof(snap)) / (header_size + sizeof(uid)) < snap.obj_count) {
+        return 1;
+    }
+
+    // send message to uid which is READONLY from the main thread, grab first 4 bytes as UID
+    *(uint32_t *)self->data_main.flatdata = snap.uid;
+
+    // channels arrive before the connection's SNAPSHOT and go by the last offset
+    if (self == conn) {
+        clock_update(self, (int64_t)sent, snap.recv_time, snap.send_time, (int64_t)self->rx_time);
+    }
+
+    // remember the data MUST start with a uint32_t unique ID for the other clients
+    record = &rx->data[sizeof(snap)];
+    end = &rx->data[rx->size];
+    for (i = 0; i < snap.obj_count; i++) {
+        if ((size_t)(end - record) < header_size + sizeof(uid)) {
+            return 1;
+        }
+        (void)memcpy(&stamp, record, sizeof(stamp));
+        size = (uint32_t)self->data_thread.flatsize;
+        if (sized) {
+            (void)memcpy(&size, &record[sizeof(stamp)], sizeof(size));
+        }
+        record += header_size;
+        (void)memcpy(&uid, record, sizeof(uid));
+
+        // a shared SNAPSHOT holds our own entities too
+        if (shared && uid_ours(self, uid)) {
+            if (size > (size_t)(end - record)) {
+                return 1;
+            }
+            record += size;
+            continue;
+        }
+        conn->stats.records_recv++;
+
+        peer = NULL;
+        track = 0;
+        if (uid < self->client_max) {
+            peer = peer_get(self, uid);
+
+            // new peers are in joined already, and no UID goes in modified twice
+            track = (peer->seen != 0 && peer->seen != conn->generation);
+            peer_seen(self, peer);
+        }
+
+        // only what changed, applied over what we had, the schema knows how long that is
+        if (self->schema_count > 0) {
+            record += sizeof(uid);
+            if (track) {
+                (void)memcpy(self->peer_prev, peer->data, self->data_thread.flatsize);
+            }
+            if (acs_schema_decode(self->schema, self->schema_count, record, (size_t)(end - record),
+                    peer ? peer->data : NULL, &used) != 0)
+            {
+                return 1;
+            }
+            if (peer) {
+                (void)memcpy(peer->data, &uid, sizeof(uid));
+                peer->size = self->data_thread.flatsize;
+            }
+            if (track && memcmp(self->peer_prev, peer->data, self->data_thread.flatsize) != 0) {
+                self->modified[self->modified_count++] = uid;
+            }
+            record += used;
+        }
+        else {
+            // and its records are as long as the server's flatsize, not ours
+            cut = 0;
+            if (shared && size > self->data_thread.flatsize && size <= (size_t)(end - record)) {
+                cut = size - (uint32_t)self->data_thread.flatsize;
+                size -= cut;
+            }
+            if (size < sizeof(uid) || size > self->data_thread.flatsize || size > (size_t)(end - record)) {
+                return 1;
+            }
+            if (track && (peer->size != size || memcmp(peer->data, record, size) != 0)) {
+                self->modified[self->modified_count++] = uid;
+            }
+            if (peer) {
+                // optional data it left out this time reads as 0
+                (void)memcpy(peer->data, record, size);
+                if (peer->size > size) {
+                    (void)memset(&peer->data[size], 0, peer->size - size);
+                }
+                peer->size = size;
+            }
+            record += size + cut;
+        }
+
+        // when the server got it, on our clock
+        if (peer) {
+            if (self->history_depth > 0) {
+                history_push(self, uid, peer, stamp);
+            }
+            stamp -= conn->clock_offset;
+            peer->stamp = (stamp > 0) ? (uint64_t)stamp : 0;
+        }
+    }
+
+    return 0;
+}
+
+static int uid_ours(struct acs_sync *self, uint32_t uid)
+{
+    size_t i;
+
+    // the UIDs the SNAPSHOT and UIDS frames gave us
+    for (i = 0; i < self->entity_count; i++) {
+        if (*(uint32_t *)((char *)self->data_main.flatdata + i * self->data_main.flatsize) == uid) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void multicast_part_put(struct acs_sync *self, const char *datagram, size_t size)
+{
+    struct multicast_part part;
+    size_t count;
+    size_t offset;
+    size_t length;
+
+    if (size < sizeof(part)) {
+        return;
+    }
+    (void)memcpy(&part, datagram, sizeof(part));
+    if (part.magic != MULTICAST_MAGIC || part.tick == 0 || part.size < sizeof(struct snapshot) || part.size > FRAME_MAX) {
+        return;
+    }
+
+    // only ever one tick being put together, a part of a newer one drops it
+    if (part.tick != self->multicast_tick) {
+        if (self->multicast_tick != 0 && (int32_t)(part.tick - self->multicast_tick) < 0) {
+            return;
+        }
+        count = (part.size + MULTICAST_PART - 1) / MULTICAST_PART;
+        buffer_reserve(&self->multicast_build, part.size);
+        self->multicast_build.size = part.size;
+        buffer_reserve(&self->multicast_have, count);
+        (void)memset(self->multicast_have.data, 0, count);
+        self->multicast_have.size = count;
+        self->multicast_tick = part.tick;
+        self->multicast_missing = count;
+    }
+
+    offset = (size_t)part.index * MULTICAST_PART;
+    if (part.size != self->multicast_build.size || part.index >= self->multicast_have.size ||
+        self->multicast_have.data[part.index])
+    {
+        return;
+    }
+    length = part.size - offset;
+    if (length > MULTICAST_PART) {
+        length = MULTICAST_PART;
+    }
+    if (size - sizeof(part) != length) {
+        return;
+    }
+
+    (void)memcpy(&self->multicast_build.data[offset], &datagram[sizeof(part)], length);
+    self->multicast_have.data[part.index] = 1;
+    self->multicast_missing--;
+
+    if (self->multicast_missing == 0) {
+        buffer_set(&self->multicast_done, self->multicast_build.data, self->multicast_build.size);
+        self->multicast_done_tick = part.tick;
+    }
+}
+
+static void multicast_collect(struct acs_sync *self, uint32_t tick, int timeout_ms)
+{
+    char datagram[sizeof(struct multicast_part) + MULTICAST_PART];
+    uint64_t deadline;
+    uint64_t now;
+    size_t received;
+    int wait_ms;
+    int rv;
+
+    deadline = acs_time_us() + (uint64_t)timeout_ms * 1000;
+    wait_ms = 0;
+    while (self->multicast_done_tick == 0 || (int32_t)(self->multicast_done_tick - tick) < 0) {
+        // take what already arrived first, only then wait for more
+        rv = acs_multicast_recv(self->multicast, datagram, sizeof(datagram), &received, wait_ms);
+        if (rv < 0) {
+            return;
+        }
+        if (rv == 0) {
+            now = acs_time_us();
+            if (now >= deadline) {
+                break;
+            }
+            wait_ms = (int)((deadline - now + 999) / 1000);
+            continue;
+        }
+        multicast_part_put(self, datagram, received);
+        wait_ms = 0;
+    }
+
+    // and keep up with the rest, so the socket never fills
+    while (acs_multicast_recv(self->multicast, datagram, sizeof(datagram), &received, 0) == 1) {
+        multicast_part_put(self, datagram, received);
+    }
+}
+
+static int tick_apply(struct acs_sync *self)
+{
+    struct buffer *rx = &self->rx;
+    struct snapshot snap;
+    struct tick tick;
+
+    if (rx->size < sizeof(tick)) {
+        return -1;
+    }
+    (void)memcpy(&tick, rx->data, sizeof(tick));
+
+    // the tick was published before the TICK naming it was sent, so it is
+    // usually here already. A group's thread has other sessions to serve
+    multicast_collect(self, tick.tick, self->grouped ? 0 : MULTICAST_WAIT_MS);
+    if (self->multicast_done_tick == 0 || (int32_t)(self->multicast_done_tick - tick.tick) < 0) {
+        // keep who we have, the next round trip gets them over TCP
+        *(uint32_t *)self->data_main.flatdata = tick.uid;
+        clock_update(self, (int64_t)self->round_start, tick.recv_time, tick.send_time, (int64_t)self->rx_time);
+        self->repair = 1;
+        self->stats.multicast_missed++;
+        return 1;
+    }
+
+    // the SNAPSHOT everyone got, with our part of the header
+    buffer_set(rx, self->multicast_done.data, self->multicast_done.size);
+    (void)memcpy(&snap, rx->data, sizeof(snap));
+    snap.uid = tick.uid;
+    snap.recv_time = tick.recv_time;
+    snap.send_time = tick.send_time;
+    (void)memcpy(rx->data, &snap, sizeof(snap));
+    self->stats.multicast_applied++;
+
+    return (snapshot_apply(self, self->round_start, 1) == 0) ? 0 : -1;
+}
+
+static void uids_apply(struct acs_sync *self)
+{
+    const struct buffer *rx = &self->conn->rx;
+    uint32_t uid;
+    size_t i;
+
+    // READONLY from the main thread like the uid in a SNAPSHOT
+    for (i = 0; i < self->entity_count && (i + 1) * sizeof(uid) <= rx->size; i++) {
+        (void)memcpy(&uid, &rx->data[i * sizeof(uid)], sizeof(uid));
+        *(uint32_t *)((char *)self->data_main.flatdata + i * self->data_main.flatsize) = uid;
+    }
+}
+
+static void keep_apply(struct acs_sync *self)
+{
+    const struct buffer *rx = &self->conn->rx;
+    struct peer *peer;
+    uint32_t uid;
+    size_t i;
+
+    // skipped to save bandwidth, so keep the last record we got
+    for (i = 0; i + sizeof(uid) <= rx->size; i += sizeof(uid)) {
+        (void)memcpy(&uid, &rx->data[i], sizeof(uid));
+        if (uid >= self->client_max) {
+            continue;
+        }
+        peer = (struct peer *)&self->peers[uid * self->peer_stride];
+        if (dlist_linked(&peer->link)) {
+            peer_seen(self, peer);
+        }
+    }
+}
+
+static void peers_prune(struct acs_sync *self)
+{
+    struct dlist_node *node;
+    struct peer *peer;
+
+    // peer_seen moved everyone this round trip held behind those it did not,
+    // so only the clients who left are looked at
+    while ((node = dlist_head(&self->recv_data)) != NULL) {
+        peer = DLIST_ENTRY(node, struct peer, link);
+        if (peer->seen == self->conn->generation) {
+            break;
+        }
+
+        // client has DC'ed, its slot stays for whoever gets the UID next
+        dlist_remove(&self->recv_data, node);
+        self->left[self->left_count++] = *(uint32_t *)peer->data;
+    }
+}
+
+static struct history_entry *history_at(struct acs_sync *self, uint32_t uid, size_t age)
+{
+    struct peer *peer = (struct peer *)&self->peers[uid * self->peer_stride];
+    size_t i;
+
+    assert(age < peer->history_count);
+
+    i = (peer->history_next + self->history_depth - 1 - age) % self->history_depth;
+    return (struct history_entry *)&self->history[(uid * self->history_depth + i) * self->history_stride];
+}
+
+static void history_push(struct acs_sync *self, uint32_t uid, struct peer *peer, int64_t stamp)
+{
+    struct history_entry *entry;
+
+    // the server sends a record again until its client sends a new one
+    if (peer->history_count > 0 && history_at(self, uid, 0)->stamp == stamp) {
+        return;
+    }
+
+    entry = (struct history_entry *)&self->history[(uid * self->history_depth + peer->history_next) * self->history_stride];
+    entry->stamp = stamp;
+    entry->size = peer->size;
+    (void)memcpy(entry->data, peer->data, self->data_thread.flatsize);
+
+    peer->history_next = (uint32_t)((peer->history_next + 1) % self->history_depth);
+    if (peer->history_count < self->history_depth) {
+        peer->history_count++;
+    }
+}
+
+static void sample_set(struct acs_sync *self, struct acs_sync_sample *sample, const struct history_entry *entry)
+{
+    int64_t stamp = entry->stamp - self->conn->clock_offset;
+
+    sample->data = entry->data;
+    sample->size = (size_t)entry->size;
+    sample->stamp = (stamp > 0) ? (uint64_t)stamp : 0;
+}
+
+static int tx_release(struct acs_sync *self, int timeout_ms)
+{
+    struct buffer tmp;
+    uint64_t mark;
+
+    // MSG_ZEROCOPY sends read tx after acs_send returned, only a
+    // completion says they are done with it
+    if (acs_zerocopy_wait(self->sock, self->tx_mark, 0) == 0) {
+        return 0;
+    }
+
+    // the spare went out a round trip earlier, so it is most likely free
+    if (acs_zerocopy_wait(self->sock, self->tx_spare_mark, timeout_ms) != 0) {
+        return 1;
+    }
+
+    tmp = self->tx;
+    self->tx = self->tx_spare;
+    self->tx_spare = tmp;
+    mark = self->tx_mark;
+    self->tx_mark = self->tx_spare_mark;
+    self->tx_spare_mark = mark;
+    return 0;
+}
+
+static int round_send(struct acs_sync *self)
+{
+    enum acs_code code;
+    size_t i;
+
+    upload_build(self);
+
+    // now we are free to do network IO without blocking/locking the main thread
+    self->round_start = acs_time_us();
+    ACS_TRACE_BEGIN(self->trace, "acs_send");
+    if (self->ring) {
+        // goes out with the worker's next acs_ring_wait
+        code = acs_ring_send(self->ring, self->sock, self->tx.data, self->tx.size);
+    }
+    else {
+        code = acs_send(self->sock, self->tx.data, self->tx.size);
+    }
+    ACS_TRACE_END(self->trace, "acs_send");
+
+    if (code != ACS_OK) {
+        return 1;
+    }
+    self->tx_mark = acs_zerocopy_mark(self->sock);
+
+    if (self->record) {
+        record_upload(self);
+    }
+
+    if (!self->connected) {
+        if (self->stats.round_trips > 0) {
+            self->stats.reconnects++;
+        }
+        self->connected = 1;
+    }
+    self->stats.bytes_sent += self->tx.size;
+    self->stats.records_sent += self->entity_count;
+    for (i = 0; i < self->channel_count; i++) {
+        self->stats.records_sent += self->channels[i]->entity_count;
+    }
+
+    // no we can fill in who is there or not locally
+    self->generation++;
+    self->joined_count = 0;
+    self->left_count = 0;
+    self->modified_count = 0;
+    for (i = 0; i < self->channel_count; i++) {
+        self->channels[i]->joined_count = 0;
+        self->channels[i]->left_count = 0;
+        self->channels[i]->modified_count = 0;
+    }
+
+    return 0;
+}
+
+static int frame_apply(struct acs_sync *self, struct frame *frame, struct acs_sync *channel)
+{
+    /*
+     * Return 1 once our SNAPSHOT ended the round trip, 0 to wait for the
+     * next frame, -1 if the server sent garbage
+     */
+
+    struct hello hello;
+    uint64_t rtt;
+    size_t i;
+    int rv;
+
+    if (!channel) {
+        // a channel we never opened, nothing to do with it
+        return 0;
+    }
+
+    if (frame->type == FRAME_HELLO && self->rx.size >= sizeof(hello)) {
+        (void)memcpy(&hello, self->rx.data, sizeof(hello));
+        self->features = hello.features;
+        return 0;
+    }
+    if (frame->type == FRAME_KEEP) {
+        keep_apply(channel);
+        return 0;
+    }
+    if (frame->type == FRAME_UIDS) {
+        uids_apply(channel);
+        return 0;
+    }
+    if (frame->type == FRAME_MESSAGES) {
+        return (messages_apply(channel) == 0) ? 0 : -1;
+    }
+    if (frame->type != FRAME_SNAPSHOT && !(frame->type == FRAME_TICK && channel == self && self->multicast)) {
+        return 0;
+    }
+
+    // the rx buffer is shared, so a channel's SNAPSHOT is applied as it comes
+    if (channel != self) {
+        ACS_TRACE_BEGIN(self->trace, "apply");
+        rv = snapshot_apply(channel, self->round_start, 0);
+        ACS_TRACE_END(self->trace, "apply");
+        return (rv == 0) ? 0 : -1;
+    }
+
+    rtt = self->rx_time - self->round_start;
+    self->stats.rtt_last = rtt;
+    self->stats.rtt_smooth = (self->stats.round_trips == 0)
+        ? rtt
+        : (self->stats.rtt_smooth * 7 + rtt) / 8;
+    self->stats.round_trips++;
+
+    ACS_TRACE_BEGIN(self->trace, "apply");
+    if (frame->type == FRAME_TICK) {
+        rv = tick_apply(self);
+    }
+    else {
+        self->repair = 0;
+        rv = snapshot_apply(self, self->round_start, 0);
+    }
+    ACS_TRACE_END(self->trace, "apply");
+    if (rv < 0) {
+        return -1;
+    }
+
+    ACS_TRACE_BEGIN(self->trace, "prune");
+    for (i = 0; i < self->channel_count; i++) {
+        peers_prune(self->channels[i]);
+    }
+    // a missed tick held nobody, so nobody left
+    if (rv == 0) {
+        peers_prune(self);
+    }
+    ACS_TRACE_END(self->trace, "prune");
+
+    // the server answered, so it has our messages
+    for (i = 0; i < self->channel_count; i++) {
+        self->channels[i]->msg_sent.size = 0;
+    }
+    self->msg_sent.size = 0;
+
+    self->stats.peer_count = self->recv_data.size;
+    stats_publish(self);
+    return 1;
+}
+
+static int thread_func(void *client)
+{
+    struct frame frame;
+    enum acs_code code;
+    struct acs_sync *self;
+    struct acs_sync *channel;
+    uint64_t start; // when the current wait began
+    int rv;
+
+    assert(initialized);
+    assert(client);
+
+    self = client;
+
+    while (self->thread_done == 0) {
+        /*
+         * Send as acs_sync_write's counterpart
+         */
+        ACS_TRACE_BEGIN(self->trace, "wait_write");
+        state_set(self, ACS_SYNC_WRITE); // user may begin reading THEN write
+        start = acs_time_us();
+        mtx_lock(&self->mutex_barrier);
+        self->stats.wait_main += acs_time_us() - start;
+        ACS_TRACE_END(self->trace, "wait_write");
+
+        /*
+         * Upon any error, the server expects us to send before it responds, so
+         * keep trying
+         */
+    send:
+        if (self->thread_done) {
+            break;
+        }
+
+        // keep trying to send until success, as the server expects a send before we recv
+        while (1) {
+            if (tx_release(self, ZEROCOPY_WAIT_MS) == 0) {
+                rv = round_send(self);
+            }
+            else {
+                // closing lets go of both
+                acs_close(self->sock);
+                rv = 1;
+            }
+
+            if (self->thread_done) {
+                goto out;
+            }
+
+            if (rv == 0) {
+                break;
+            }
+
+            // reset UID / wait before retrying to connect
+            uid_reset(self);
+            (void)millisleep(10);
+        }
+
+        /*
+         * Recv frames up to the SNAPSHOT, which goes into the list for acs_sync_read_next to get
+         */
+        do {
+            ACS_TRACE_BEGIN(self->trace, "recv_frame");
+            code = frame_recv(self, &frame, &channel);
+            ACS_TRACE_END(self->trace, "recv_frame");
+
+            if (self->thread_done) {
+                goto out;
+            }
+
+            rv = (code == ACS_OK) ? frame_apply(self, &frame, channel) : -1;
+            if (rv < 0) {
+                // upon failure, reset the UID and go back to step 1: try to send to the server
+                acs_close(self->sock);
+                uid_reset(self);
+                goto send;
+            }
+        } while (rv == 0);
+
+        // wait for user to read
+        ACS_TRACE_BEGIN(self->trace, "wait_read");
+        state_set(self, ACS_SYNC_READ);
+        start = acs_time_us();
+        mtx_lock(&self->mutex_barrier);
+        self->stats.wait_main += acs_time_us() - start;
+        ACS_TRACE_END(self->trace, "wait_read");
+    }
+
+out:
+    return 0;
+}
+
+static void group_fail(struct acs_sync *self)
+{
+    // like thread_func, start over from the send
+    acs_close(self->sock);
+    uid_reset(self);
+    self->step = STEP_SEND;
+}
+
+static int group_step(struct acs_sync *self)
+{
+    uint64_t now;
+
+    now = acs_time_us();
+
+    switch (self->step) {
+    case STEP_WAIT_WRITE:
+        if (mtx_trylock(&self->mutex_barrier) != thrd_success) {
+            return 1;
+        }
+        self->stats.wait_main += now - self->wait_start;
+        self->step = STEP_SEND;
+        // fall through
+
+    case STEP_SEND:
+        if (now < self->retry_at) {
+            return 1;
+        }
+
+        // rather than hold up the other sessions while the kernel reads tx, come back on a later pass
+        if (tx_release(self, 0) != 0) {
+            if (self->tx_held_at == 0) {
+                self->tx_held_at = now;
+            }
+            self->retry_at = now + GROUP_RETRY_US;
+            if (now - self->tx_held_at < (uint64_t)ZEROCOPY_WAIT_MS * 1000) {
+                return 1;
+            }
+
+            // as long as thread_func would wait, then closing lets go of both
+            acs_close(self->sock);
+            uid_reset(self);
+            self->tx_held_at = 0;
+            return 1;
+        }
+        self->tx_held_at = 0;
+
+        if (round_send(self) != 0) {
+            uid_reset(self);
+            self->retry_at = now + GROUP_RETRY_US;
+            return 1;
+        }
+        self->inbox.size = 0;
+        self->inbox_pos = 0;
+        self->step = STEP_RECV;
+        return 0;
+
+    case STEP_WAIT_READ:
+        if (mtx_trylock(&self->mutex_barrier) != thrd_success) {
+            return 1;
+        }
+        self->stats.wait_main += now - self->wait_start;
+        self->wait_start = now;
+        state_set(self, ACS_SYNC_WRITE); // user may begin reading THEN write
+        self->step = STEP_WAIT_WRITE;
+        return 1;
+
+    default:
+        return 0;
+    }
+}
+
+static void group_recv(struct acs_sync *self)
+{
+    enum acs_code code;
+    size_t received;
+
+    ACS_TRACE_BEGIN(self->trace, "recv_frame");
+    buffer_reserve(&self->inbox, self->inbox.size + GROUP_RECV_MIN);
+    code = acs_recv_some(self->sock, &self->inbox.data[self->inbox.size], self->inbox.capacity - self->inbox.size, &received);
+    ACS_TRACE_END(self->trace, "recv_frame");
+    if (code != ACS_OK) {
+        group_fail(self);
+        return;
+    }
+
+    group_frames(self, received);
+}
+
+static void group_frames(struct acs_sync *self, size_t received)
+{
+    struct frame frame;
+    struct acs_sync *channel;
+    enum acs_code code;
+    int rv;
+
+    // close enough to when the next frame began to arrive
+    if (self->inbox.size == self->inbox_pos) {
+        self->rx_time = acs_time_us();
+    }
+    self->inbox.size += received;
+
+    while (self->inbox.size - self->inbox_pos >= sizeof(frame)) {
+        (void)memcpy(&frame, &self->inbox.data[self->inbox_pos], sizeof(frame));
+        if (frame.size > FRAME_MAX) {
+            group_fail(self);
+            return;
+        }
+        if (self->inbox.size - self->inbox_pos < sizeof(frame) + frame.size) {
+            break;
+        }
+
+        buffer_set(&self->rx, &self->inbox.data[self->inbox_pos + sizeof(frame)], frame.size);
+        self->inbox_pos += sizeof(frame) + frame.size;
+
+        code = frame_unpack(self, &frame, &channel);
+        rv = (code == ACS_OK) ? frame_apply(self, &frame, channel) : -1;
+        if (rv < 0) {
+            group_fail(self);
+            return;
+        }
+
+        // nothing else comes until our next upload
+        if (rv > 0) {
+            self->wait_start = acs_time_us();
+            state_set(self, ACS_SYNC_READ);
+            self->step = STEP_WAIT_READ;
+            return;
+        }
+    }
+
+    // keep the start of the next frame, with room for all of it
+    (void)memmove(self->inbox.data, &self->inbox.data[self->inbox_pos], self->inbox.size - self->inbox_pos);
+    self->inbox.size -= self->inbox_pos;
+    self->inbox_pos = 0;
+    if (self->inbox.size >= sizeof(frame)) {
+        (void)memcpy(&frame, self->inbox.data, sizeof(frame));
+        buffer_reserve(&self->inbox, sizeof(frame) + frame.size);
+    }
+}
+
+static void group_ring(struct group_worker *worker, int timeout_ms)
+{
+    struct acs_ring_event event;
+    struct acs_sync *sync;
+
+    if (acs_ring_wait(worker->ring, timeout_ms) < 0) {
+        (void)millisleep(GROUP_SPIN_MS);
+        return;
+    }
+
+    while (acs_ring_next(worker->ring, &event)) {
+        sync = event.tag;
+
+        // only a session waiting on frames can start over, any other finds
+        // out when its next send fails
+        if (event.code != ACS_OK) {
+            if (sync->step == STEP_RECV) {
+                group_fail(sync);
+            }
+            continue;
+        }
+
+        if (event.kind == ACS_RING_RECV && sync->step == STEP_RECV) {
+            buffer_reserve(&sync->inbox, sync->inbox.size + event.size);
+            (void)memcpy(&sync->inbox.data[sync->inbox.size], event.data, event.size);
+            group_frames(sync, event.size);
+        }
+    }
+}
+
+static int group_func(void *arg)
+{
+    struct group_worker *worker;
+    struct acs_sync *sync;
+    size_t count;
+    size_t i;
+    int waiting; // whether someone waits on their main thread or a retry, which poll can't see
+    int rv;
+
+    assert(initialized);
+    assert(arg);
+
+    worker = arg;
+
+    for (i = 0; i < worker->sync_count; i++) {
+        sync = worker->syncs[i];
+        sync->step = STEP_WAIT_WRITE;
+        sync->wait_start = acs_time_us();
+        state_set(sync, ACS_SYNC_WRITE);
+    }
+
+    while (worker->group->done == 0) {
+        waiting = 0;
+        count = 0;
+        for (i = 0; i < worker->sync_count; i++) {
+            sync = worker->syncs[i];
+            if (group_step(sync) != 0) {
+                waiting = 1;
+            }
+            else if (sync->step == STEP_RECV && !worker->ring) {
+                worker->socks[count] = sync->sock;
+                worker->polled[count] = sync;
+                count++;
+            }
+        }
+
+        if (worker->ring) {
+            group_ring(worker, waiting ? GROUP_SPIN_MS : GROUP_IDLE_MS);
+            continue;
+        }
+
+        rv = acs_poll(worker->socks, count, worker->readable, waiting ? GROUP_SPIN_MS : GROUP_IDLE_MS, worker->poll_scratch);
+        if (rv < 0) {
+            (void)millisleep(GROUP_SPIN_MS);
+            continue;
+        }
+
+        for (i = 0; i < count; i++) {
+            if (worker->readable[i]) {
+                group_recv(worker->polled[i]);
+            }
+        }
+    }
+
+    return 0;
+}
+
+static struct acs_sync *sync_alloc(size_t max_clients, void *flatdata, size_t flatsize, size_t count)
+{
+    struct acs_sync *self;
+
+    self = acs_calloc(1, sizeof(*self));
+    assert(self);
+
+    // not doing anything
+    self->thread_done = 1;
+
+    /*
+     * send stuff
+     */
+
+    self->data_main.flatdata = flatdata;
+    self->data_main.flatsize = flatsize;
+
+    self->data_thread.flatdata = acs_malloc(count * flatsize);
+    assert(self->data_thread.flatdata);
+    self->data_thread.flatsize = flatsize;
+    self->write_size = flatsize;
+    self->entity_count = count;
+
+    // interested in everyone by default
+    self->key_offset = -1;
+    self->sub_uids = acs_malloc(max_clients * sizeof(*self->sub_uids));
+    assert(self->sub_uids);
+
+    // and at full rate
+    self->rate_periods = acs_calloc(max_clients, sizeof(*self->rate_periods));
+    assert(self->rate_periods);
+
+    /*
+     * recv stuff
+     */
+    // the peers live in the slots and link themselves into the list, none is linked yet
+    dlist_init(&self->recv_data);
+    self->peer_stride = (sizeof(struct peer) + flatsize + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+    self->peers = acs_calloc(max_clients, self->peer_stride);
+    assert(self->peers);
+    self->cursor_main = NULL;
+
+    // delta coding is off until acs_sync_set_compression, so start small
+    buffer_init(&self->tx_prev, 1);
+    buffer_init(&self->rx_prev, 1);
+    buffer_init(&self->packed, 1);
+    buffer_init(&self->msg_out, 1);
+    buffer_init(&self->msg_sent, 1);
+    buffer_init(&self->msg_in, 1);
+
+    self->state_ref = acs_calloc(count, flatsize);
+    assert(self->state_ref);
+
+    // each UID joins or leaves at most once a round trip
+    self->joined = acs_malloc(max_clients * sizeof(*self->joined));
+    self->left = acs_malloc(max_clients * sizeof(*self->left));
+    self->modified = acs_malloc(max_clients * sizeof(*self->modified));
+    self->peer_prev = acs_malloc(flatsize);
+    assert(self->joined && self->left && self->modified && self->peer_prev);
+    self->client_max = max_clients;
+
+    return self;
+}
+
+static void sync_free(struct acs_sync *self)
+{
+    acs_free(self->peers);
+    acs_free(self->history);
+
+    if (self->data_thread.flatdata) {
+        acs_free(self->data_thread.flatdata);
+    }
+
+    acs_free(self->joined);
+    acs_free(self->left);
+    acs_free(self->modified);
+    acs_free(self->peer_prev);
+
+    buffer_free(&self->tx_prev);
+    buffer_free(&self->rx_prev);
+    buffer_free(&self->packed);
+    buffer_free(&self->inbox);
+    buffer_free(&self->msg_out);
+    buffer_free(&self->msg_sent);
+    buffer_free(&self->msg_in);
+
+    acs_free(self->state_ref);
+    acs_free(self->schema);
+
+    acs_free(self->sub_uids);
+    acs_free(self->rate_periods);
+
+    acs_free(self);
+}
+
+/*
+ * Public Function Definitions
+ */
+
+enum acs_code acs_sync_init(void)
+{
+    enum acs_code rv;
+
+    assert(initialized == 0);
+
+    rv = acs_init();
+    initialized = 1;
+    return rv;
+}
+
+void acs_sync_cleanup(void)
+{
+    assert(initialized == 1);
+    acs_cleanup();
+    initialized = 0;
+}
+
+struct acs_sync *acs_sync_new(const char *host, const char *port, size_t max_clients, void *flatdata, size_t flatsize)
+{
+    return acs_sync_new_multi(host, port, max_clients, flatdata, flatsize, 1);
+}
+
+struct acs_sync *acs_sync_new_multi(const char *host, const char *port, size_t max_clients, void *flatdata, size_t flatsize, size_t count)
+{
+    struct acs_sync *self;
+
+    assert(initialized);
+    assert(host);
+    assert(port);
+    assert(flatdata);
+    assert(count > 0);
+
+    self = sync_alloc(max_clients, flatdata, flatsize, count);
+
+    self->sock = acs_new(host, port);
+    assert(self->sock);
+    self->conn = self;
+
+    mtx_init(&self->mutex_barrier, mtx_plain);
+    mtx_init(&self->mutex_stats, mtx_plain);
+
+    // room for a HELLO and a STATE, or STATES of every entity
+    buffer_init(&self->tx, 2 * sizeof(struct frame) + sizeof(struct hello) + sizeof(uint32_t) + count * (sizeof(uint32_t) + flatsize));
+
+    // room for a SNAPSHOT of max_clients
+    buffer_init(&self->rx, sizeof(struct snapshot) + max_clients * (sizeof(int64_t) + flatsize));
+
+    // delta coding is off until acs_sync_set_compression, so start small
+    buffer_init(&self->unpacked, 1);
+
+#ifdef ACS_TRACE
+    self->trace = acs_trace_new(ACS_TRACE_CAPACITY, ++trace_tid);
+    assert(self->trace);
+#endif
+
+    return self;
+}
+
+struct acs_sync *acs_sync_new_channel(struct acs_sync *conn, size_t max_clients, void *flatdata, size_t flatsize, size_t count)
+{
+    struct acs_sync *self;
+
+    assert(initialized);
+    assert(conn);
+    assert(conn->conn == conn);
+    assert(conn->thread_done == 1);
+    assert(flatdata);
+    assert(count > 0);
+    assert(conn->channel_count < FRAME_CHANNEL_MAX);
+
+    self = sync_alloc(max_clients, flatdata, flatsize, count);
+    self->conn = conn;
+    self->channel = (uint32_t)conn->channel_count + 1;
+
+    conn->channels = acs_realloc(conn->channels, (conn->channel_count + 1) * sizeof(*conn->channels));
+    assert(conn->channels);
+    conn->channels[conn->channel_count++] = self;
+
+    // the connection's tx carries our CHANNEL and STATES too, its rx our SNAPSHOT
+    buffer_reserve(&conn->tx, conn->tx.capacity + 2 * sizeof(struct frame) + 2 * sizeof(uint32_t) + count * (sizeof(uint32_t) + flatsize));
+    buffer_reserve(&conn->rx, sizeof(struct snapshot) + max_clients * (sizeof(int64_t) + flatsize));
+
+    return self;
+}
+
+void acs_sync_del(struct acs_sync *self)
+{
+    size_t i;
+
+    assert(initialized);
+    assert(self);
+    assert(self->conn == self);
+    assert(self->thread_done == 1 || !self->grouped);
+
+    if (self->thread_done == 0) {
+        // raise the flag before releasing the barrier so the thread sees it
+        self->thread_done = 1;
+        while (mtx_trylock(&self->mutex_barrier) != thrd_busy);
+        (void)mtx_unlock(&self->mutex_barrier);
+        (void)thrd_join(self->thread, NULL);
+    }
+
+    for (i = 0; i < self->channel_count; i++) {
+        sync_free(self->channels[i]);
+    }
+    acs_free(self->channels);
+
+    if (self->sock) {
+        acs_del(self->sock);
+    }
+
+    buffer_free(&self->tx);
+    buffer_free(&self->tx_spare);
+    buffer_free(&self->rx);
+    buffer_free(&self->unpacked);
+
+    if (self->record) {
+        acs_record_del(self->record);
+    }
+
+    if (self->multicast) {
+        acs_multicast_del(self->multicast);
+    }
+    buffer_free(&self->multicast_build);
+    buffer_free(&self->multicast_have);
+    buffer_free(&self->multicast_done);
+
+    mtx_destroy(&self->mutex_barrier);
+    mtx_destroy(&self->mutex_stats);
+
+#ifdef ACS_TRACE
+    acs_trace_del(self->trace);
+#endif
+
+    sync_free(self);
+}
+
+
+int acs_sync_run(struct acs_sync *self)
+{
+    assert(initialized);
+    assert(self);
+    assert(self->conn == self);
+    assert(self->thread_done == 1);
+    assert(!self->grouped);
+
+    // the thread checks this flag as soon as it starts, and must block on
+    // its first barrier until the main thread writes
+    self->thread_done = 0;
+    mtx_lock(&self->mutex_barrier);
+    if (thrd_create(&self->thread, thread_func, self) == thrd_success) {
+        return 0;
+    }
+    mtx_unlock(&self->mutex_barrier);
+    self->thread_done = 1;
+    return 1;
+}
+
+void acs_sync_set_variable(struct acs_sync *self)
+{
+    assert(initialized);
+    assert(self);
+    assert(self->conn->thread_done == 1);
+
+    self->sized = 1;
+}
+
+void acs_sync_set_compression(struct acs_sync *self, size_t threshold)
+{
+    assert(initialized);
+    assert(self);
+    assert(self->conn->thread_done == 1);
+
+    self->delta_min = threshold;
+}
+
+void acs_sync_set_history(struct acs_sync *self, size_t depth)
+{
+    assert(initialized);
+    assert(self);
+    assert(self->conn->thread_done == 1);
+
+    acs_free(self->history);
+    self->history = NULL;
+    self->history_depth = depth;
+    if (depth == 0) {
+        return;
+    }
+
+    // one block up front, the network thread only copies into it
+    self->history_stride = (sizeof(struct history_entry) + self->data_thread.flatsize + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+    self->history = acs_malloc(self->client_max * depth * self->history_stride);
+    assert(self->history);
+}
+
+int acs_sync_set_record(struct acs_sync *self, const char *path, size_t segment_size)
+{
+    assert(initialized);
+    assert(self);
+    assert(self->conn == self);
+    assert(self->thread_done == 1);
+    assert(path);
+
+    if (self->record) {
+        acs_record_del(self->record);
+    }
+    self->record = acs_record_new(path, segment_size, ACS_RECORD_CLIENT);
+    return self->record ? 0 : 1;
+}
+
+int acs_sync_set_zerocopy(struct acs_sync *self, size_t threshold)
+{
+    assert(initialized);
+    assert(self);
+    assert(self->conn == self);
+    assert(self->thread_done == 1);
+
+    return acs_set_zerocopy(self->sock, threshold);
+}
+
+int acs_sync_set_multicast(struct acs_sync *self, const char *group, const char *port, const char *iface)
+{
+    assert(initialized);
+    assert(self);
+    assert(self->conn == self);
+    assert(self->thread_done == 1);
+    assert(group);
+    assert(port);
+
+    if (self->multicast) {
+        acs_multicast_del(self->multicast);
+    }
+    self->multicast = acs_multicast_new(group, port, iface);
+    if (!self->multicast) {
+        return 1;
+    }
+
+    // the server sends everyone sized records, so we take them too
+    self->sized = 1;
+    return 0;
+}
+
+int acs_sync_set_schema(struct acs_sync *self, const struct acs_sync_field *fields, size_t count)
+{
+    assert(initialized);
+    assert(self);
+    assert(self->conn->thread_done == 1);
+
+    if (acs_schema_check(fields, count, self->data_main.flatsize) != 0) {
+        return 1;
+    }
+
+    acs_free(self->schema);
+    self->schema = acs_malloc(count * sizeof(*fields));
+    assert(self->schema);
+    (void)memcpy(self->schema, fields, count * sizeof(*fields));
+    self->schema_count = count;
+    return 0;
+}
+
+void acs_sync_set_key(struct acs_sync *self, size_t offset)
+{
+    assert(initialized);
+    assert(self);
+    assert(self->conn->thread_done == 1);
+    assert(offset + 2 * sizeof(float) <= self->data_main.flatsize);
+
+    self->key_offset = (long)offset;
+}
+
+int acs_sync_subscribe(struct acs_sync *self, const uint32_t *uids, size_t count, const struct acs_sync_region *region)
+{
+    assert(initialized);
+    assert(self);
+    assert(self->conn->thread_done == 1 || self->state == ACS_SYNC_WRITE);
+    assert(uids || count == 0);
+
+    if (count > self->client_max) {
+        return 1;
+    }
+
+    if (count > 0) {
+        (void)memcpy(self->sub_uids, uids, count * sizeof(*uids));
+    }
+    self->sub_count = count;
+
+    self->sub_has_region = (region != NULL);
+    if (region) {
+        self->sub_region = *region;
+    }
+
+    self->dirty |= DIRTY_SUBSCRIBE;
+    return 0;
+}
+
+int acs_sync_set_rates(struct acs_sync *self, const struct acs_sync_rates *rates)
+{
+    assert(initialized);
+    assert(self);
+    assert(self->conn->thread_done == 1 || self->state == ACS_SYNC_WRITE);
+    assert(rates);
+
+    if (rates->subscribed == 0 || rates->region == 0 || rates->other == 0) {
+        return 1;
+    }
+
+    self->rates = *rates;
+    self->rates_set = 1;
+    self->dirty |= DIRTY_RATES;
+    return 0;
+}
+
+int acs_sync_set_rate(struct acs_sync *self, uint32_t uid, uint32_t period)
+{
+    assert(initialized);
+    assert(self);
+    assert(self->conn->thread_done == 1 || self->state == ACS_SYNC_WRITE);
+
+    if (uid >= self->client_max) {
+        return 1;
+    }
+
+    if (self->rate_periods[uid] == 0 && period != 0) {
+        self->rate_count++;
+    }
+    else if (self->rate_periods[uid] != 0 && period == 0) {
+        self->rate_count--;
+    }
+    self->rate_periods[uid] = period;
+
+    // per UID periods alone still need the class defaults on the server
+    if (!self->rates_set) {
+        self->rates.subscribed = 1;
+        self->rates.region = 1;
+        self->rates.other = 1;
+        self->rates.budget = 0;
+        self->rates_set = 1;
+    }
+    self->dirty |= DIRTY_RATES;
+    return 0;
+}
+
+void acs_sync_write(struct acs_sync *self)
+{
+    assert(initialized);
+    assert(self);
+    assert(self->state == ACS_SYNC_WRITE);
+
+    (void)memcpy(self->data_thread.flatdata, self->data_main.flatdata, self->entity_count * self->data_thread.flatsize);
+    self->write_size = self->data_thread.flatsize;
+
+    barrier_release(self);
+}
+
+void acs_sync_write_size(struct acs_sync *self, size_t size)
+{
+    assert(initialized);
+    assert(self);
+    assert(self->state == ACS_SYNC_WRITE);
+    assert(size >= sizeof(uint32_t) && size <= self->data_main.flatsize);
+    assert(self->entity_count == 1);
+
+    (void)memcpy(self->data_thread.flatdata, self->data_main.flatdata, size);
+    self->write_size = size;
+
+    barrier_release(self);
+}
+
+void *acs_sync_read_next(struct acs_sync *self)
+{
+    assert(initialized);
     assert(self);
     assert(self->state == ACS_SYNC_READ);
 
     // first time called
     if (self->cursor_main == NULL) {
-        self->cursor_main = list_iter_begin(self->recv_data);
+        self->cursor_main = dlist_head(&self->recv_data);
     }
     // subsequent times called
     else {
-        list_iter_continue(&self->cursor_main);
+        self->cursor_main = dlist_next(&self->recv_data, self->cursor_main);
+    }
+
+    // the next was NULL, so unlock the barrier and return NULL
+    if (self->cursor_main == NULL) {
+        barrier_release(self);
+        return NULL;
     }
 
-    // the continue was NULL, so unlock the barrier and return NULL
-    if (list_iter_done(self->cursor_main)) {
+    // the next wasn't NULL so return its value
+    return DLIST_ENTRY(self->cursor_main, struct peer, link)->data;
+}
+
+void *acs_sync_read_changed(struct acs_sync *self, enum acs_sync_change *change)
+{
+    struct peer *peer;
+    size_t i;
+    uint32_t uid;
+
+    assert(initialized);
+    assert(self);
+    assert(change);
+    assert(self->state == ACS_SYNC_READ);
+
+    // joined, then modified, then left, as if they were one list
+    i = self->change_cursor++;
+    if (i < self->joined_count) {
+        *change = ACS_SYNC_ADDED;
+        uid = self->joined[i];
+    }
+    else if ((i -= self->joined_count) < self->modified_count) {
+        *change = ACS_SYNC_MODIFIED;
+        uid = self->modified[i];
+    }
+    else if ((i -= self->modified_count) < self->left_count) {
+        *change = ACS_SYNC_REMOVED;
+        uid = self->left[i];
+    }
+    // no more changes, so unlock the barrier and return NULL
+    else {
+        self->change_cursor = 0;
         self->cursor_main = NULL;
+        barrier_release(self);
+        return NULL;
+    }
 
-        // wait until the lock is locked before unlocking it
-        self->state = ACS_SYNC_BUSY; // user may not touch read/write
-        while (mtx_trylock(&self->mutex_barrier) != thrd_busy);
-        mtx_unlock(&self->mutex_barrier);
+    // a peer who left keeps its last data in its slot until the UID comes back
+    peer = (struct peer *)&self->peers[uid * self->peer_stride];
+    self->cursor_main = &peer->link;
+    return peer->data;
+}
+
+void acs_sync_send_message(struct acs_sync *self, uint32_t to, const void *data, size_t size)
+{
+    struct message msg;
+
+    assert(initialized);
+    assert(self);
+    assert(data || size == 0);
+    assert(self->conn->thread_done == 1 || self->state == ACS_SYNC_WRITE);
+    assert(size <= FRAME_MAX - sizeof(msg));
+
+    msg.from = 0;
+    msg.to = to;
+    msg.size = (uint32_t)size;
+
+    buffer_reserve(&self->msg_out, self->msg_out.size + sizeof(msg) + size);
+    (void)memcpy(&self->msg_out.data[self->msg_out.size], &msg, sizeof(msg));
+    if (size > 0) {
+        (void)memcpy(&self->msg_out.data[self->msg_out.size + sizeof(msg)], data, size);
+    }
+    self->msg_out.size += sizeof(msg) + size;
+}
+
+void *acs_sync_read_message(struct acs_sync *self, uint32_t *from, size_t *size)
+{
+    struct message msg;
+    char *data;
+
+    assert(initialized);
+    assert(self);
+    assert(from);
+    assert(size);
+    assert(self->state == ACS_SYNC_READ);
 
+    // all read, make room for the next round trip's
+    if (self->msg_cursor >= self->msg_in.size) {
+        self->msg_in.size = 0;
+        self->msg_cursor = 0;
         return NULL;
     }
 
-    // the continue wasn't NULL so return the next value
-    return list_iter_value(self->cursor_main);
+    (void)memcpy(&msg, &self->msg_in.data[self->msg_cursor], sizeof(msg));
+    data = &self->msg_in.data[self->msg_cursor + sizeof(msg)];
+    self->msg_cursor += sizeof(msg) + msg.size;
+
+    *from = msg.from;
+    *size = msg.size;
+    return data;
+}
+
+size_t acs_sync_read_size(struct acs_sync *self)
+{
+    assert(initialized);
+    assert(self);
+    assert(self->state == ACS_SYNC_READ);
+    assert(self->cursor_main != NULL);
+
+    return (size_t)DLIST_ENTRY(self->cursor_main, struct peer, link)->size;
+}
+
+uint64_t acs_sync_read_age(struct acs_sync *self)
+{
+    struct peer *peer;
+    uint64_t now;
+
+    assert(initialized);
+    assert(self);
+    assert(self->state == ACS_SYNC_READ);
+    assert(self->cursor_main != NULL);
+
+    peer = DLIST_ENTRY(self->cursor_main, struct peer, link);
+    now = acs_time_us();
+    return (now > peer->stamp) ? now - peer->stamp : 0;
+}
+
+size_t acs_sync_read_joined(struct acs_sync *self, const uint32_t **uids)
+{
+    assert(initialized);
+    assert(self);
+    assert(uids);
+    assert(self->state == ACS_SYNC_READ);
+
+    *uids = self->joined;
+    return self->joined_count;
+}
+
+size_t acs_sync_read_left(struct acs_sync *self, const uint32_t **uids)
+{
+    assert(initialized);
+    assert(self);
+    assert(uids);
+    assert(self->state == ACS_SYNC_READ);
+
+    *uids = self->left;
+    return self->left_count;
+}
+
+int acs_sync_read_between(struct acs_sync *self, uint32_t uid, uint64_t when, struct acs_sync_sample *older, struct acs_sync_sample *newer)
+{
+    struct peer *peer;
+    int64_t server;
+    size_t age;
+
+    assert(initialized);
+    assert(self);
+    assert(older);
+    assert(newer);
+    assert(self->state == ACS_SYNC_READ);
+
+    if (self->history_depth == 0 || uid >= self->client_max) {
+        return 2;
+    }
+    peer = (struct peer *)&self->peers[uid * self->peer_stride];
+    if (!dlist_linked(&peer->link) || peer->history_count == 0) {
+        return 2;
+    }
+
+    // the history keeps the server's stamps, usually close to now, so look from the newest back
+    server = (int64_t)when + self->conn->clock_offset;
+    if (server >= history_at(self, uid, 0)->stamp) {
+        sample_set(self, older, history_at(self, uid, 0));
+        sample_set(self, newer, history_at(self, uid, 0));
+        return 1;
+    }
+    for (age = 1; age < peer->history_count; age++) {
+        if (history_at(self, uid, age)->stamp <= server) {
+            sample_set(self, older, history_at(self, uid, age));
+            sample_set(self, newer, history_at(self, uid, age - 1));
+            return 0;
+        }
+    }
+
+    sample_set(self, older, history_at(self, uid, peer->history_count - 1));
+    sample_set(self, newer, history_at(self, uid, peer->history_count - 1));
+    return 1;
 }
 
 enum acs_sync_state acs_sync_get_state(struct acs_sync *self)
@@ -489,3 +2604,207 @@ enum acs_sync_state acs_sync_get_state(struct acs_sync *self)
     assert(self);
     return self->state;
 }
+
+void acs_sync_get_stats(struct acs_sync *self, struct acs_sync_stats *stats)
+{
+    assert(initialized);
+    assert(self);
+    assert(stats);
+
+    // a channel's round trips are its connection's
+    self = self->conn;
+
+    // only ever waits for the network thread's copy of the same few words
+    mtx_lock(&self->mutex_stats);
+    *stats = self->stats_shared;
+    mtx_unlock(&self->mutex_stats);
+}
+
+int acs_sync_trace_dump(struct acs_sync *self, const char *path)
+{
+#ifdef ACS_TRACE
+    FILE *fp;
+    int rv;
+
+    assert(initialized);
+    assert(self);
+    assert(path);
+    assert(self->state == ACS_SYNC_READ || self->state == ACS_SYNC_WRITE);
+
+    fp = fopen(path, "w");
+    if (!fp) {
+        return 1;
+    }
+
+    rv = acs_trace_dump(self->conn->trace, fp);
+    if (fclose(fp) != 0) {
+        rv = 1;
+    }
+    return rv;
+#else
+    (void)self;
+    (void)path;
+    return 1;
+#endif
+}
+
+struct acs_sync_group *acs_sync_group_new(size_t threads)
+{
+    struct acs_sync_group *self;
+
+    assert(initialized);
+    assert(threads > 0);
+
+    self = acs_calloc(1, sizeof(*self));
+    assert(self);
+    self->thread_max = threads;
+
+    return self;
+}
+
+void acs_sync_group_del(struct acs_sync_group *self)
+{
+    struct acs_sync *sync;
+    size_t i;
+
+    assert(initialized);
+    assert(self);
+
+    self->done = 1;
+    for (i = 0; i < self->running; i++) {
+        (void)thrd_join(self->workers[i].thread, NULL);
+    }
+
+    // ours again to delete, or to run on their own, so back to how acs_sync_run finds them
+    for (i = 0; i < self->sync_count; i++) {
+        sync = self->syncs[i];
+
+        // locked unless the main thread just released it, unlocked either way
+        (void)mtx_trylock(&sync->mutex_barrier);
+        mtx_unlock(&sync->mutex_barrier);
+
+        // a SNAPSHOT still on its way would answer the next upload
+        if (sync->step == STEP_RECV) {
+            acs_close(sync->sock);
+            uid_reset(sync);
+        }
+
+        state_set(sync, ACS_SYNC_BUSY);
+        sync->step = STEP_WAIT_WRITE;
+        sync->retry_at = 0;
+        sync->tx_held_at = 0;
+        sync->thread_done = 1;
+        sync->grouped = 0;
+        sync->ring = NULL;
+        buffer_free(&sync->inbox);
+        sync->inbox_pos = 0;
+    }
+
+    for (i = 0; i < self->worker_count; i++) {
+        if (self->workers[i].ring) {
+            acs_ring_del(self->workers[i].ring);
+        }
+        acs_free(self->workers[i].syncs);
+        acs_free(self->workers[i].socks);
+        acs_free(self->workers[i].polled);
+        acs_free(self->workers[i].readable);
+        acs_free(self->workers[i].poll_scratch);
+    }
+    acs_free(self->workers);
+    acs_free(self->syncs);
+    acs_free(self);
+}
+
+void acs_sync_group_add(struct acs_sync_group *self, struct acs_sync *sync)
+{
+    assert(initialized);
+    assert(self);
+    assert(!self->workers);
+    assert(sync);
+    assert(sync->conn == sync);
+    assert(sync->thread_done == 1);
+    assert(!sync->grouped);
+
+    self->syncs = acs_realloc(self->syncs, (self->sync_count + 1) * sizeof(*self->syncs));
+    assert(self->syncs);
+    self->syncs[self->sync_count++] = sync;
+
+    sync->grouped = 1;
+    buffer_init(&sync->inbox, GROUP_RECV_MIN);
+}
+
+int acs_sync_group_run(struct acs_sync_group *self)
+{
+    struct group_worker *worker;
+    size_t count;
+    size_t i;
+    size_t j;
+
+    assert(initialized);
+    assert(self);
+    assert(!self->workers);
+
+    count = (self->sync_count < self->thread_max) ? self->sync_count : self->thread_max;
+    if (count == 0) {
+        return 0;
+    }
+
+    self->workers = acs_calloc(count, sizeof(*self->workers));
+    assert(self->workers);
+    self->worker_count = count;
+
+    // deal the sessions out like cards
+    for (i = 0; i < count; i++) {
+        worker = &self->workers[i];
+        worker->group = self;
+        worker->syncs = acs_malloc(((self->sync_count + count - 1) / count) * sizeof(*worker->syncs));
+        assert(worker->syncs);
+    }
+    for (i = 0; i < self->sync_count; i++) {
+        worker = &self->workers[i % count];
+        worker->syncs[worker->sync_count++] = self->syncs[i];
+    }
+    for (i = 0; i < count; i++) {
+        worker = &self->workers[i];
+        worker->socks = acs_malloc(worker->sync_count * sizeof(*worker->socks));
+        worker->polled = acs_malloc(worker->sync_count * sizeof(*worker->polled));
+        worker->readable = acs_malloc(worker->sync_count);
+        worker->poll_scratch = acs_malloc(acs_poll_size(worker->sync_count));
+        assert(worker->socks && worker->polled && worker->readable && worker->poll_scratch);
+
+        // one syscall a pass for all the sessions' IO, if the build and kernel have it
+        worker->ring = acs_ring_new(worker->sync_count, worker->sync_count * GROUP_RING_BUFFERS, GROUP_RECV_MIN);
+        for (j = 0; worker->ring && j < worker->sync_count; j++) {
+            acs_ring_add(worker->ring, worker->syncs[j]->sock, worker->syncs[j]);
+            worker->syncs[j]->ring = worker->ring;
+        }
+    }
+
+    // the workers block on the barriers, see acs_sync_run
+    for (i = 0; i < self->sync_count; i++) {
+        self->syncs[i]->thread_done = 0;
+        mtx_lock(&self->syncs[i]->mutex_barrier);
+    }
+
+    for (i = 0; i < count; i++) {
+        if (thrd_create(&self->workers[i].thread, group_func, &self->workers[i]) != thrd_success) {
+            break;
+        }
+        self->running++;
+    }
+    if (self->running == count) {
+        return 0;
+    }
+
+    // all or nothing, the sessions go back to how they were
+    self->done = 1;
+    for (i = 0; i < self->running; i++) {
+        (void)thrd_join(self->workers[i].thread, NULL);
+    }
+    self->running = 0;
+    for (i = 0; i < self->sync_count; i++) {
+        mtx_unlock(&self->syncs[i]->mutex_barrier);
+        self->syncs[i]->thread_done = 1;
+    }
+    return 1;
+}
@@ -1,9 +1,16 @@
 #ifndef ACS_SYNC_H
 #define ACS_SYNC_H
 
+#include <stdint.h>
+
 #include "acs.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 struct acs_sync;
+struct acs_sync_group;
 
 /**
  * When acs_sync_get_state returns the corresponding enum,
@@ -11,10 +18,94 @@ struct acs_sync;
  */
 enum acs_sync_state {
     ACS_SYNC_BUSY,  /** System is NOT ready for reading or writing */
-    ACS_SYNC_READ,  /** acs_sync_read_next is allowed */
+    ACS_SYNC_READ,  /** acs_sync_read_next or acs_sync_read_changed is allowed */
     ACS_SYNC_WRITE, /** acs_sync_write is allowed */
 };
 
+/**
+ * What happened to a record acs_sync_read_changed returns
+ */
+enum acs_sync_change {
+    ACS_SYNC_ADDED,    /** the client appeared */
+    ACS_SYNC_MODIFIED, /** its data differs from the last round trip */
+    ACS_SYNC_REMOVED,  /** the client went away, this is its last data */
+};
+
+/**
+ * A record as a peer held it once, see acs_sync_read_between
+ */
+struct acs_sync_sample {
+    const void *data;       /** its flatdata, in the history rather than a copy */
+    size_t size;            /** bytes it holds, like acs_sync_read_size */
+    uint64_t stamp;         /** when the server received it, on our clock by the latest offset */
+};
+
+/**
+ * Counters describing what the network thread has been doing. Durations
+ * are in microseconds.
+ */
+struct acs_sync_stats {
+    uint64_t bytes_sent;    /** bytes handed to acs_send */
+    uint64_t bytes_recv;    /** bytes taken from acs_recv */
+    uint64_t records_sent;  /** flatdata records uploaded */
+    uint64_t records_recv;  /** client records downloaded */
+    uint64_t round_trips;   /** completed send/recv exchanges */
+    uint64_t reconnects;    /** connections made after the first one */
+    uint64_t uid_resets;    /** times the UID was reset to 0 after an error */
+    uint64_t rtt_last;      /** duration of the last round trip */
+    uint64_t rtt_smooth;    /** moving average of the round trip duration */
+    uint64_t peer_count;    /** other clients held after the last round trip */
+    uint64_t wait_main;     /** total time spent waiting on the main thread */
+    int64_t clock_offset;   /** estimated server clock minus ours */
+    uint64_t multicast_applied; /** snapshots taken from the multicast group */
+    uint64_t multicast_missed;  /** ticks that did not arrive whole, sent again over TCP */
+};
+
+/**
+ * Area of interest for acs_sync_subscribe, bounds are inclusive
+ */
+struct acs_sync_region {
+    float min[2];
+    float max[2];
+};
+
+/**
+ * How often the server sends each client, as a period in our round trips:
+ * 1 is every round trip, 4 every 4th, 16 every 16th
+ */
+struct acs_sync_rates {
+    uint32_t subscribed; /** clients in the UIDs given to acs_sync_subscribe */
+    uint32_t region;     /** clients in the region given to acs_sync_subscribe */
+    uint32_t other;      /** everyone, when not subscribed */
+    uint32_t budget;     /** most bytes of records per round trip, 0 for no limit */
+};
+
+/**
+ * How a flatdata member is put on the wire, see acs_sync_set_schema
+ */
+enum acs_sync_field_type {
+    ACS_SYNC_F32,   /** float, quantized to bits over [min, max] */
+    ACS_SYNC_I8,    /** int8_t, sent as its distance from min */
+    ACS_SYNC_I16,   /** int16_t, sent as its distance from min */
+    ACS_SYNC_I32,   /** int32_t, sent as its distance from min */
+    ACS_SYNC_U8,    /** uint8_t, sent as its distance from min */
+    ACS_SYNC_U16,   /** uint16_t, sent as its distance from min */
+    ACS_SYNC_U32,   /** uint32_t, sent as its distance from min */
+    ACS_SYNC_BYTES, /** size bytes sent as they are */
+};
+
+/**
+ * One flatdata member in a schema
+ */
+struct acs_sync_field {
+    size_t offset;                   /** offsetof the member, past the uid */
+    enum acs_sync_field_type type;
+    unsigned bits;                   /** bits on the wire from 1 to 32, unused for ACS_SYNC_BYTES */
+    float min;                       /** lowest value, values outside the range are clamped */
+    float max;                       /** highest value, only used by ACS_SYNC_F32 */
+    size_t size;                     /** bytes, only used by ACS_SYNC_BYTES */
+};
+
 /**
  * Initialize the library
  */
@@ -41,7 +132,35 @@ void acs_sync_cleanup(void);
 struct acs_sync *acs_sync_new(const char *host, const char *port, size_t max_clients, void *flatdata, size_t flatsize);
 
 /**
- * Join the thread and free all heap memory
+ * Like acs_sync_new, but publish @a count entities from one connection and
+ * one thread. @a flatdata is an array of @a count records of @a flatsize
+ * bytes, each starting with its own uid, which the server assigns and
+ * removes together. Every acs_sync_write uploads all of them in one frame.
+ * acs_sync_read_next never returns our own entities. @a max_clients must
+ * leave room for them.
+ */
+struct acs_sync *acs_sync_new_multi(const char *host, const char *port, size_t max_clients, void *flatdata, size_t flatsize, size_t count);
+
+/**
+ * Open a channel on @a conn: another stream of @a count records of
+ * @a flatsize bytes, with its own UIDs on the server, carried by the socket,
+ * thread and round trip of @a conn. Use one per record type instead of one
+ * connection each. A channel takes every function but acs_sync_run and
+ * acs_sync_del, and is freed with @a conn. It shares the states of @a conn:
+ * write and read its channels BEFORE @a conn itself, since writing or
+ * finishing the read loop of @a conn ends the turn of all of them. A channel
+ * left unwritten sends its last flatdata again.
+ *
+ * @warning
+ *   ONLY CALL THIS FUNCTION BEFORE acs_sync_run ON @a conn
+ */
+struct acs_sync *acs_sync_new_channel(struct acs_sync *conn, size_t max_clients, void *flatdata, size_t flatsize, size_t count);
+
+/**
+ * Join the thread and free all heap memory, channels included
+ *
+ * @warning
+ *   NOT FOR A CHANNEL
  */
 void acs_sync_del(struct acs_sync *self);
 
@@ -50,6 +169,181 @@ void acs_sync_del(struct acs_sync *self);
  */
 int acs_sync_run(struct acs_sync *self);
 
+/**
+ * Make a group to run many sessions on @a threads network threads instead of
+ * one thread each. Each thread polls the sockets of its sessions, so it pays
+ * for tools holding hundreds of them. Sessions keep their API, but their
+ * barriers are checked rather than waited on, which adds up to a millisecond
+ * to each, and dialing still blocks the thread. Built with -DACS_URING, the
+ * threads batch their sessions' IO thru acs_ring instead, where the kernel
+ * has it.
+ */
+struct acs_sync_group *acs_sync_group_new(size_t threads);
+
+/**
+ * Stop the group's threads and free it. Its sessions are left as before
+ * acs_sync_run, to delete now or to run on their own thread
+ *
+ * @warning
+ *   CALL THIS FUNCTION BEFORE acs_sync_del ON ITS SESSIONS
+ */
+void acs_sync_group_del(struct acs_sync_group *self);
+
+/**
+ * Have the group run @a sync, in place of acs_sync_run
+ *
+ * @warning
+ *   ONLY CALL THIS FUNCTION BEFORE acs_sync_group_run, NOT FOR A CHANNEL
+ */
+void acs_sync_group_add(struct acs_sync_group *self, struct acs_sync *sync);
+
+/**
+ * Begin comms for every session in the group, return 0 on success, 1 on failure
+ */
+int acs_sync_group_run(struct acs_sync_group *self);
+
+/**
+ * Describe the members of your flatdata so only they are sent, each packed
+ * into as few bits as you allow, and only when they changed since the
+ * server or the peer last saw them. Members left out of @a fields, and
+ * padding, are not sent and read as 0 in other clients' flatdata. Every
+ * client of a server must use the same schema. If you use acs_sync_set_key,
+ * both floats of the key must be ACS_SYNC_F32 fields.
+ *
+ * Return 0 on success, 1 if a field is out of the flatdata or has no bits
+ * or range
+ *
+ * @warning
+ *   ONLY CALL THIS FUNCTION BEFORE acs_sync_run
+ */
+int acs_sync_set_schema(struct acs_sync *self, const struct acs_sync_field *fields, size_t count);
+
+/**
+ * Receive records as long as their senders wrote them with
+ * acs_sync_write_size instead of padded to our flatsize, which becomes the
+ * most a record may hold. Optional trailing data then only costs bandwidth
+ * when it is there. Has no effect with a schema.
+ *
+ * @warning
+ *   ONLY CALL THIS FUNCTION BEFORE acs_sync_run
+ */
+void acs_sync_set_variable(struct acs_sync *self);
+
+/**
+ * Ask the server to delta code frames against the previous one on the
+ * connection, and do the same for our own flatdata when it is at least
+ * @a threshold bytes. Worth it when bandwidth is scarcer than CPU and the
+ * flatdata is hundreds of bytes or the server holds many clients. 0, the
+ * default, turns it off.
+ *
+ * @warning
+ *   ONLY CALL THIS FUNCTION BEFORE acs_sync_run
+ */
+void acs_sync_set_compression(struct acs_sync *self, size_t threshold);
+
+/**
+ * Keep the last @a depth records of every peer, each with when the server
+ * received it, for acs_sync_read_between to interpolate from. Records the
+ * server sends again unchanged are only kept once. Takes about
+ * max_clients * @a depth * flatsize bytes, allocated here. 0, the default,
+ * keeps none.
+ *
+ * @warning
+ *   ONLY CALL THIS FUNCTION BEFORE acs_sync_run
+ */
+void acs_sync_set_history(struct acs_sync *self, size_t depth);
+
+/**
+ * Log every frame the connection sends and receives, with when, to memory
+ * mapped files @a path.000000, @a path.000001, ... of @a segment_size bytes,
+ * 0 for 64 MiB. acs_replay.py plays a log back against a server, or to a
+ * client in place of one. The log is closed by acs_sync_del.
+ *
+ * Return 0 on success, 1 if the first segment cannot be created
+ *
+ * @warning
+ *   ONLY CALL THIS FUNCTION BEFORE acs_sync_run, AND ON THE CONNECTION, NOT A CHANNEL
+ */
+int acs_sync_set_record(struct acs_sync *self, const char *path, size_t segment_size);
+
+/**
+ * Get the snapshot from the server's multicast @a group on @a port, such as
+ * "239.255.0.1" and "9997", joined on the interface with address @a iface,
+ * "127.0.0.1" for loopback or NULL for the one the routes pick. On a LAN the
+ * server then sends each tick's snapshot once for every client, which all
+ * keep uploading and registering over TCP. A tick that does not arrive whole
+ * is sent again over TCP. Snapshots from the group hold everyone on the
+ * connection's channel 0, whatever acs_sync_subscribe and the rates say, and
+ * may be up to one server tick old. Ignored with a schema or when the
+ * server was not started with a group.
+ *
+ * Return 0 on success, 1 if the group cannot be joined
+ *
+ * @warning
+ *   ONLY CALL THIS FUNCTION BEFORE acs_sync_run, AND ON THE CONNECTION, NOT A CHANNEL
+ */
+int acs_sync_set_multicast(struct acs_sync *self, const char *group, const char *port, const char *iface);
+
+/**
+ * Send uploads of @a threshold bytes or more without copying them into the
+ * kernel, thru Linux MSG_ZEROCOPY, 0 to stop. For big flatdata or many
+ * entities, sent to another host: the kernel copies to loopback anyway, and
+ * below about 10 KB the bookkeeping costs more than the copy. An upload's
+ * buffer is only reused once the kernel is done with it, uploads alternate
+ * between two while it is not.
+ *
+ * Return 0 on success, 1 if not supported here, where uploads are copied
+ *
+ * @warning
+ *   ONLY CALL THIS FUNCTION BEFORE acs_sync_run, AND ON THE CONNECTION, NOT A CHANNEL
+ */
+int acs_sync_set_zerocopy(struct acs_sync *self, size_t threshold);
+
+/**
+ * Declare that your flatdata holds a "float position[2];" at @a offset. The
+ * server indexes it so others can subscribe to the region you are in.
+ *
+ * @warning
+ *   ONLY CALL THIS FUNCTION BEFORE acs_sync_run
+ */
+void acs_sync_set_key(struct acs_sync *self, size_t offset);
+
+/**
+ * Only receive the clients listed in @a uids, plus those whose key (see
+ * acs_sync_set_key) lies inside @a region if it is not NULL. Subscribing
+ * with no UIDs and no region receives everyone again, which is the default.
+ * Clients leaving your interest disappear from acs_sync_read_next as if they
+ * had disconnected.
+ *
+ * Return 0 on success, 1 if @a count is more than max_clients
+ *
+ * @warning
+ *   ONLY CALL THIS FUNCTION BEFORE acs_sync_run OR IF THE STATE IS ACS_SYNC_WRITE
+ */
+int acs_sync_subscribe(struct acs_sync *self, const uint32_t *uids, size_t count, const struct acs_sync_region *region);
+
+/**
+ * Set the update period of each interest class and the download budget.
+ * Within the budget, shorter periods go first, then whoever waited longest,
+ * so important clients stay fresh while the rest catch up when there is
+ * room. Clients skipped in a round trip keep their last record.
+ *
+ * Return 0 on success, 1 if a period is 0
+ *
+ * @warning
+ *   ONLY CALL THIS FUNCTION BEFORE acs_sync_run OR IF THE STATE IS ACS_SYNC_WRITE
+ */
+int acs_sync_set_rates(struct acs_sync *self, const struct acs_sync_rates *rates);
+
+/**
+ * Override the update period of one client, 0 returns it to its class.
+ * Return 0 on success, 1 if @a uid is not below max_clients
+ *
+ * @warning
+ *   ONLY CALL THIS FUNCTION BEFORE acs_sync_run OR IF THE STATE IS ACS_SYNC_WRITE
+ */
+int acs_sync_set_rate(struct acs_sync *self, uint32_t uid, uint32_t period);
+
 /**
  * Tell the thread to send whatever is in your flatdata. Please note
  * that you must fill flatdata up whenever you are prepared to send.
@@ -63,6 +357,50 @@ int acs_sync_run(struct acs_sync *self);
  */
 void acs_sync_write(struct acs_sync *self);
 
+/**
+ * Like acs_sync_write, but only send the first @a size bytes of your flatdata,
+ * at least the uid and at most flatsize. Others read the rest as 0, see
+ * acs_sync_set_variable. Not for acs_sync_new_multi.
+ *
+ * @warning
+ *   ONLY CALL THIS FUNCTION IF THE STATE IS ACS_SYNC_WRITE
+ */
+void acs_sync_write_size(struct acs_sync *self, size_t size);
+
+/**
+ * Queue @a size bytes of @a data for the client whose entity has UID @a to,
+ * or for every other client on the channel if @a to is 0. Messages go with
+ * the next round trip, in the order they were queued, and unlike flatdata
+ * none is ever overwritten or dropped. If the connection breaks they are
+ * sent again, so a receiver may rarely get one twice.
+ *
+ * @warning
+ *   ONLY CALL THIS FUNCTION BEFORE acs_sync_run OR IF THE STATE IS ACS_SYNC_WRITE
+ */
+void acs_sync_send_message(struct acs_sync *self, uint32_t to, const void *data, size_t size);
+
+/**
+ * Return the next message sent to us, storing the UID of its sender in
+ * @a from and its length in @a size, or NULL once all have been read. The
+ * data is not aligned and only valid during this ACS_SYNC_READ. Messages
+ * not read stay for the next one.
+ *
+ * @code
+ * uint32_t from;
+ * size_t size;
+ * char *msg;
+ *
+ * while ((msg = acs_sync_read_message(my_acs_sync, &from, &size)) != NULL) {
+ *   printf("%u: %.*s\n", from, (int)size, msg);
+ * }
+ * // then acs_sync_read_next to the end as always
+ * @endcode
+ *
+ * @warning
+ *   ONLY CALL THIS FUNCTION IF THE STATE IS ACS_SYNC_READ, BEFORE acs_sync_read_next RETURNS NULL
+ */
+void *acs_sync_read_message(struct acs_sync *self, uint32_t *from, size_t *size);
+
 /**
  * You use this function like an iterator reader to copy into your
  * version of the data. It will return NULL when there is no more
@@ -91,9 +429,129 @@ void acs_sync_write(struct acs_sync *self);
  */
 void *acs_sync_read_next(struct acs_sync *self);
 
+/**
+ * Like acs_sync_read_next, but only the records added, modified or removed
+ * since the last round trip, each with its kind of change in @a change, so
+ * reading costs as much as what changed. Records stamped again with the
+ * same data are left out. acs_sync_read_size and acs_sync_read_age work
+ * after it the same way.
+ *
+ * @code
+ * enum acs_sync_change change;
+ * struct mystruct *p;
+ *
+ * while ((p = acs_sync_read_changed(my_acs_sync, &change)) != NULL) {
+ *   if (change == ACS_SYNC_REMOVED) {
+ *     memset(&global_items[p->uid], 0, sizeof(struct mystruct));
+ *   }
+ *   else {
+ *     memcpy(&global_items[p->uid], p, sizeof(struct mystruct));
+ *   }
+ * }
+ * @endcode
+ *
+ * @warning
+ *   DO NOT BREAK OUT OF THIS LOOP, CONTINUE THRU THE REST OF IT ELSE DEADLOCK
+ * @warning
+ *   DO NOT MIX WITH acs_sync_read_next IN THE SAME ROUND TRIP
+ * @warning
+ *   ONLY CALL THIS FUNCTION IF THE STATE IS ACS_SYNC_READ
+ */
+void *acs_sync_read_changed(struct acs_sync *self, enum acs_sync_change *change);
+
+/**
+ * Bytes the record last returned by acs_sync_read_next holds, flatsize unless
+ * acs_sync_set_variable was called
+ *
+ * @warning
+ *   ONLY CALL THIS FUNCTION RIGHT AFTER acs_sync_read_next RETURNED A RECORD
+ */
+size_t acs_sync_read_size(struct acs_sync *self);
+
+/**
+ * How many microseconds ago the server received the record last returned by
+ * acs_sync_read_next, measured on our clock using the estimated offset to the
+ * server's. Use it to interpolate or to measure state propagation latency.
+ *
+ * @warning
+ *   ONLY CALL THIS FUNCTION RIGHT AFTER acs_sync_read_next RETURNED A RECORD
+ */
+uint64_t acs_sync_read_age(struct acs_sync *self);
+
+/**
+ * UIDs of the clients that acs_sync_read_next returns for the first time
+ * this round trip, pointed to by @a uids until the read is done. Returns
+ * how many
+ *
+ * @warning
+ *   ONLY CALL THIS FUNCTION IF THE STATE IS ACS_SYNC_READ
+ */
+size_t acs_sync_read_joined(struct acs_sync *self, const uint32_t **uids);
+
+/**
+ * UIDs of the clients that acs_sync_read_next returned last round trip but
+ * no longer does, because they left or left our interest, like
+ * acs_sync_read_joined
+ *
+ * @warning
+ *   ONLY CALL THIS FUNCTION IF THE STATE IS ACS_SYNC_READ
+ */
+size_t acs_sync_read_left(struct acs_sync *self, const uint32_t **uids);
+
+/**
+ * Find the records of @a uid on either side of @a when, an acs_time_us on
+ * our clock, in the history kept by acs_sync_set_history. The samples point
+ * into the history until the read is done, so interpolate between them
+ * without copying.
+ *
+ * @code
+ * struct acs_sync_sample a, b;
+ * uint64_t when = acs_time_us() - 100000; // render 100 ms in the past
+ * float t;
+ *
+ * if (acs_sync_read_between(my_acs_sync, p->uid, when, &a, &b) == 0) {
+ *   t = (float)(when - a.stamp) / (float)(b.stamp - a.stamp);
+ *   // lerp between the members of a.data and b.data by t
+ * }
+ * @endcode
+ *
+ * \return
+ *       0 @a older is at or before @a when and @a newer after it
+ *       1 @a when is outside the history, both are the closest record
+ *       2 there is no history for @a uid
+ *
+ * @warning
+ *   ONLY CALL THIS FUNCTION IF THE STATE IS ACS_SYNC_READ
+ */
+int acs_sync_read_between(struct acs_sync *self, uint32_t uid, uint64_t when, struct acs_sync_sample *older, struct acs_sync_sample *newer);
+
 /**
  * Get the current state. May be polled at any time.
  */
 enum acs_sync_state acs_sync_get_state(struct acs_sync *self);
 
+/**
+ * Copy the latest statistics into @a stats. May be polled at any time,
+ * the network thread publishes them once per round trip, holding a lock
+ * only for the copy.
+ * A channel gives those of its connection.
+ */
+void acs_sync_get_stats(struct acs_sync *self, struct acs_sync_stats *stats);
+
+/**
+ * Write the network thread's recent phases to @a path as Chrome trace JSON:
+ * wait_write and wait_read for the barrier waits, acs_send, recv_frame for
+ * each frame received, apply for a SNAPSHOT or TICK and prune for the
+ * disconnect sweep. Return 0 on success, 1 on failure or if the library
+ * was not built with -DACS_TRACE
+ *
+ * @warning
+ *   ONLY CALL THIS FUNCTION IF THE STATE IS ACS_SYNC_READ OR ACS_SYNC_WRITE
+ */
+int acs_sync_trace_dump(struct acs_sync *self, const char *path);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif // ACS_SYNC_H
@@ -0,0 +1,253 @@
+#ifndef ACS_SYNC_HPP
+#define ACS_SYNC_HPP
+
+/**
+ * ACS_SYNC for C++20, header only. acs::sync<T> checks at compile time that
+ * T is flatdata: trivially copyable, standard layout and starting with a
+ * uint32_t uid. Records are copied with sizeof(T) known to the compiler,
+ * and reads hand back spans of T instead of void pointers.
+ *
+ * Include this instead of acs_sync.h: the C API is declared in namespace
+ * acs, as acs::acs_sync_init() and acs::ACS_SYNC_READ, since in C++ the name
+ * of struct acs would clash with the namespace.
+ *
+ * @code
+ * struct player {
+ *   uint32_t uid;
+ *   float pos[2];
+ * };
+ *
+ * acs::acs_sync_init();
+ * acs::sync<player> sync("localhost", "9999", 64);
+ * sync.run();
+ * switch (sync.state()) {
+ * case acs::ACS_SYNC_READ:
+ *   for (const player &p : sync.read()) {
+ *     draw(p);
+ *   }
+ *   break;
+ * case acs::ACS_SYNC_WRITE:
+ *   sync.data()[0].pos[0] += 1.0f;
+ *   sync.write();
+ *   break;
+ * default:
+ *   break;
+ * }
+ * @endcode
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <type_traits>
+#include <utility>
+
+// already included, so the C headers do not pull them into the namespace
+#include <stddef.h>
+#include <stdint.h>
+
+namespace acs {
+
+namespace c {
+#include "acs_sync.h"
+} // namespace c
+
+using namespace c;
+
+template <typename T>
+class sync {
+    static_assert(std::is_trivially_copyable_v<T>, "flatdata is copied as bytes, T must be trivially copyable");
+    static_assert(std::is_standard_layout_v<T>, "flatdata goes over the wire as laid out, T must be standard layout");
+    static_assert(std::is_same_v<decltype(T::uid), std::uint32_t>, "T must start with a uint32_t uid");
+    static_assert(offsetof(T, uid) == 0, "T must start with a uint32_t uid");
+
+public:
+    /**
+     * Like acs_sync_new_multi for \a count entities of T, all 0 to start.
+     * acs_sync_init must have been called. Check the result with operator bool
+     */
+    sync(const char *host, const char *port, std::size_t max_clients, std::size_t count = 1)
+        : count_(count), max_clients_(max_clients)
+    {
+        // ours then room for everyone, in one block that stays put when we move
+        records_ = static_cast<T *>(acs_calloc(count + max_clients, sizeof(T)));
+        if (!records_) {
+            return;
+        }
+        handle_ = acs_sync_new_multi(host, port, max_clients, records_, sizeof(T), count);
+    }
+
+    sync(const sync &) = delete;
+    sync &operator=(const sync &) = delete;
+
+    sync(sync &&other) noexcept
+        : handle_(std::exchange(other.handle_, nullptr)),
+          records_(std::exchange(other.records_, nullptr)),
+          count_(other.count_),
+          max_clients_(other.max_clients_)
+    {
+    }
+
+    sync &operator=(sync &&other) noexcept
+    {
+        if (this != &other) {
+            reset();
+            handle_ = std::exchange(other.handle_, nullptr);
+            records_ = std::exchange(other.records_, nullptr);
+            count_ = other.count_;
+            max_clients_ = other.max_clients_;
+        }
+        return *this;
+    }
+
+    /**
+     * acs_sync_del, which joins the network thread
+     */
+    ~sync()
+    {
+        reset();
+    }
+
+    explicit operator bool() const
+    {
+        return handle_ != nullptr;
+    }
+
+    /**
+     * The session, for the rest of acs_sync.h
+     */
+    struct acs_sync *get() const
+    {
+        return handle_;
+    }
+
+    /**
+     * Begin comms in another thread, 0 on success, 1 on failure
+     */
+    int run()
+    {
+        return acs_sync_run(handle_);
+    }
+
+    enum acs_sync_state state() const
+    {
+        return acs_sync_get_state(handle_);
+    }
+
+    /**
+     * Our entities, the main thread may change all but their uid
+     */
+    std::span<T> data()
+    {
+        return {records_, count_};
+    }
+
+    /**
+     * acs_sync_write
+     *
+     * @warning
+     *   ONLY CALL THIS FUNCTION IF THE STATE IS ACS_SYNC_WRITE
+     */
+    void write()
+    {
+        acs_sync_write(handle_);
+    }
+
+    /**
+     * Copy everyone else out and finish the read, so the network thread goes
+     * on. The span holds up to max_clients records until the next read
+     *
+     * @warning
+     *   ONLY CALL THIS FUNCTION IF THE STATE IS ACS_SYNC_READ, AFTER ANY read_message, joined OR left
+     */
+    std::span<const T> read()
+    {
+        T *peers = records_ + count_;
+        std::size_t n = 0;
+
+        for (void *p = acs_sync_read_next(handle_); p != nullptr; p = acs_sync_read_next(handle_)) {
+            if (n < max_clients_) {
+                std::memcpy(&peers[n++], p, sizeof(T));
+            }
+        }
+        return {peers, n};
+    }
+
+    /**
+     * Like acs_sync_send_message
+     *
+     * @warning
+     *   ONLY CALL THIS FUNCTION IF THE STATE IS ACS_SYNC_WRITE
+     */
+    void send_message(std::uint32_t to, std::span<const std::byte> message)
+    {
+        acs_sync_send_message(handle_, to, message.data(), message.size());
+    }
+
+    /**
+     * Like acs_sync_read_message, false when there are no more. \a message
+     * points into the session until the read is done
+     *
+     * @warning
+     *   ONLY CALL THIS FUNCTION IF THE STATE IS ACS_SYNC_READ, BEFORE read
+     */
+    bool read_message(std::uint32_t &from, std::span<const std::byte> &message)
+    {
+        std::size_t size = 0;
+        void *data = acs_sync_read_message(handle_, &from, &size);
+
+        if (!data) {
+            return false;
+        }
+        message = {static_cast<const std::byte *>(data), size};
+        return true;
+    }
+
+    /**
+     * Like acs_sync_read_joined and acs_sync_read_left
+     *
+     * @warning
+     *   ONLY CALL THESE FUNCTIONS IF THE STATE IS ACS_SYNC_READ, BEFORE read
+     */
+    std::span<const std::uint32_t> joined()
+    {
+        const std::uint32_t *uids = nullptr;
+        std::size_t count = acs_sync_read_joined(handle_, &uids);
+        return {uids, count};
+    }
+
+    std::span<const std::uint32_t> left()
+    {
+        const std::uint32_t *uids = nullptr;
+        std::size_t count = acs_sync_read_left(handle_, &uids);
+        return {uids, count};
+    }
+
+    struct acs_sync_stats stats()
+    {
+        struct acs_sync_stats rv;
+        acs_sync_get_stats(handle_, &rv);
+        return rv;
+    }
+
+private:
+    void reset()
+    {
+        if (handle_) {
+            acs_sync_del(handle_);
+            handle_ = nullptr;
+        }
+        acs_free(records_);
+        records_ = nullptr;
+    }
+
+    struct acs_sync *handle_ = nullptr;
+    T *records_ = nullptr;          // count_ of ours, then max_clients_ read copies
+    std::size_t count_;
+    std::size_t max_clients_;
+};
+
+} // namespace acs
+
+#endif // ACS_SYNC_HPP
@@ -2,22 +2,641 @@
 Server software
 """
 
+import collections
+import itertools
+import json
+import math
+import mmap
+import os
+import re
+import select
+import signal
+import socket
 import socketserver
 import struct
 import sys
+import threading
 import time
-from typing import Dict, List
+from typing import Callable, Deque, Dict, Iterable, List, Optional, Set, Tuple, Union
 
-class AcsSync:
-    def __init__(self, host: str, port: int, flatsize: int, max_clients: int):
+try:
+    import fcntl
+    import termios
+except ImportError: # Windows, no send queue depth
+    fcntl = None
+
+##
+# Wire protocol, see the Wire Protocol comment in acs_sync.c. Frames are a
+# "<II" type and size followed by size bytes, times are clock_us()
+PROTOCOL_VERSION = 2
+FRAME_HELLO = 0x32534341 # "ACS2", always first so it doubles as the magic
+FRAME_STATE = 2
+FRAME_SNAPSHOT = 3
+FRAME_KEY = 4
+FRAME_SUBSCRIBE = 5
+FRAME_RATES = 6
+FRAME_KEEP = 7
+FRAME_SCHEMA = 8
+FRAME_STATES = 9
+FRAME_UIDS = 10
+FRAME_CHANNEL = 11
+FRAME_MESSAGES = 12 # "<III" from, to and size, then size bytes, as many as fit
+FRAME_PEER = 13 # between servers, "<I" count then each client's "<ffqI" key, age and size, then its flatdata
+FRAME_TICK = 14 # "<IIqq" uid, tick, recv_time and send_time, in place of a SNAPSHOT for multicast clients
+FRAME_REPAIR = 15 # empty, the client missed a tick and wants a SNAPSHOT for this STATE
+FRAME_CHANNEL_SHIFT = 16 # channel id in bits 16 to 30 of every type but HELLO
+FRAME_CHANNEL_MAX = 0x7fff
+FRAME_DELTA = 0x80000000 # set in the type of a delta coded frame
+FRAME_MAX = 64 << 20 # largest frame payload accepted
+FEATURE_DELTA = 0x1
+FEATURE_SIZED = 0x2 # records are sized instead of padded to flatsize
+FEATURE_PEER = 0x4 # the HELLO of another server, see Link
+FEATURE_MULTICAST = 0x8 # the client gets its snapshots from our multicast group, see AcsSync.publish
+FEATURES = FEATURE_DELTA | FEATURE_SIZED # optional features this server accepts
+
+##
+# Each tick's SNAPSHOT goes to the multicast group as datagrams of a "<IIII"
+# magic, tick, index and size of the whole payload, then up to MULTICAST_PART
+# bytes of it from index * MULTICAST_PART
+MULTICAST_MAGIC = 0x4d534341 # "ACSM"
+MULTICAST_PART = 1200 # so a datagram fits an Ethernet frame
+
+##
+# Frame logs, see acs_record.h for the format. A segment is a "<4sIII" header
+# then "<QIIII" entries each followed by their payload padded to 8 bytes
+RECORD_VERSION = 1
+RECORD_CLIENT = 0 # origin of a log written by acs_sync
+RECORD_SERVER = 1 # origin of a log written by this server
+RECORD_RECV = 0
+RECORD_SEND = 1
+RECORD_HEADER = 16
+RECORD_ENTRY = 24
+RECORD_SEGMENT = 64 << 20
+
+PEER_RETRY = 1.0 # seconds before dialing a peer again
+
+SENDMSG_MAX = 512 # buffers handed to one sendmsg, well under any IOV_MAX
+
+##
+# The server's clock in microseconds
+def clock_us() -> int:
+    return time.monotonic_ns() // 1000
+
+##
+# Bytes written to sock that the kernel has not sent yet, 0 where unknown
+def send_queue(sock: socket.socket) -> int:
+    if fcntl is None or not hasattr(termios, "TIOCOUTQ"):
+        return 0
+    try:
+        return struct.unpack("i", fcntl.ioctl(sock.fileno(), termios.TIOCOUTQ, b"\0\0\0\0"))[0]
+    except OSError:
+        return 0
+
+def frame(ftype: int, payload: bytes) -> bytes:
+    return struct.pack("<II", ftype, len(payload)) + payload
+
+##
+# Channel id and type of a frame type off the wire
+def frame_channel(ftype: int) -> Tuple[int, int]:
+    if ftype == FRAME_HELLO:
+        return 0, ftype
+    return (ftype >> FRAME_CHANNEL_SHIFT) & FRAME_CHANNEL_MAX, ftype & ~(FRAME_CHANNEL_MAX << FRAME_CHANNEL_SHIFT)
+
+##
+# Delta coding against the previous frame, see acs_delta.h for the format
+DELTA_MIN_RUN = 8
+DELTA_RUN = re.compile(b"\\x00{%d,}" % DELTA_MIN_RUN)
+
+def _varint(value: int) -> bytes:
+    rv = bytearray()
+    while value >= 0x80:
+        rv.append((value & 0x7f) | 0x80)
+        value >>= 7
+    rv.append(value)
+    return bytes(rv)
+
+def delta_encode(data: bytes, prev: bytes) -> bytes:
+    size = len(data)
+    # runs equal to prev are the zero runs of the two xored together
+    base = prev[:size].ljust(size, b"\0")
+    diff = (int.from_bytes(data, "little") ^ int.from_bytes(base, "little")).to_bytes(size, "little")
+
+    rv = [struct.pack("<I", size)]
+    pos = 0
+    for run in DELTA_RUN.finditer(diff):
+        start, end = run.span()
+        if start > pos:
+            rv.append(_varint((start - pos) << 1))
+            rv.append(data[pos:start])
+        rv.append(_varint(((end - start) << 1) | 1))
+        pos = end
+    if pos < size:
+        rv.append(_varint((size - pos) << 1))
+        rv.append(data[pos:])
+    return b"".join(rv)
+
+##
+# Raise ValueError if payload is malformed
+def delta_decode(payload: bytes, prev: bytes) -> bytes:
+    size, = struct.unpack_from("<I", payload)
+    if size > FRAME_MAX:
+        raise ValueError("delta frame too large")
+
+    rv = bytearray()
+    i = 4
+    while len(rv) < size:
+        value = 0
+        shift = 0
+        while True:
+            if i >= len(payload) or shift > 28:
+                raise ValueError("bad delta token")
+            byte = payload[i]
+            i += 1
+            value |= (byte & 0x7f) << shift
+            shift += 7
+            if not byte & 0x80:
+                break
+
+        count = value >> 1
+        if count > size - len(rv):
+            raise ValueError("bad delta token")
+        if value & 1:
+            pos = len(rv)
+            rv += prev[pos:pos + count].ljust(count, b"\0")
+        else:
+            if i + count > len(payload):
+                raise ValueError("bad delta token")
+            rv += payload[i:i + count]
+            i += count
+
+    if i != len(payload):
+        raise ValueError("trailing delta bytes")
+    return bytes(rv)
+
+##
+# What a client asked to receive in its SUBSCRIBE frame
+class Interest:
+    def __init__(self, uids: Set[int], region: Optional[Tuple[float, float, float, float]]):
+        self.uids: Set[int] = uids
+        # min x, min y, max x, max y
+        self.region: Optional[Tuple[float, float, float, float]] = region
+
+##
+# Fields from a client's SCHEMA frame. Records are a uint32 uid then a bit
+# stream, least significant bit first: one bit per field telling whether it
+# follows, then those fields, padded to a byte. Fields are kept as their
+# quantized ints, see acs_schema.h
+SCHEMA_F32 = 0
+
+class Schema:
+    def __init__(self, payload: bytes):
+        count, = struct.unpack_from("<I", payload)
+        # (type, bits, min, max) of each field
+        self.fields: Tuple[Tuple[int, int, float, float], ...] = tuple(
+            struct.iter_unpack("<IIff", payload[4:4 + 16 * count]))
+        if len(self.fields) != count:
+            raise ValueError("short schema")
+        self.widths: Tuple[int, ...] = tuple(bits for _, bits, _, _ in self.fields)
+        # most bytes a record takes
+        self.size: int = 4 + (count + sum(self.widths) + 7) // 8
+
+    def __eq__(self, other) -> bool:
+        return isinstance(other, Schema) and self.fields == other.fields
+
+    def __hash__(self) -> int:
+        return hash(self.fields)
+
+    ##
+    # Apply the fields in data onto values
+    def decode(self, data: bytes, values: List[int]):
+        count = len(self.widths)
+        stream = int.from_bytes(data, "little")
+        pos = count
+        for i, width in enumerate(self.widths):
+            if stream >> i & 1:
+                if pos + width > 8 * len(data):
+                    raise ValueError("short record")
+                values[i] = stream >> pos & ((1 << width) - 1)
+                pos += width
+
+    ##
+    # The fields of values that differ from ref, all of them without one
+    def encode(self, values: Tuple[int, ...], ref: Optional[Tuple[int, ...]]) -> bytes:
+        count = len(self.widths)
+        stream = 0
+        pos = count
+        for i, width in enumerate(self.widths):
+            if ref is None or values[i] != ref[i]:
+                stream |= 1 << i | values[i] << pos
+                pos += width
+        return stream.to_bytes((pos + 7) // 8, "little")
+
+    ##
+    # Value of F32 field i
+    def real(self, values: List[int], i: int) -> float:
+        _, bits, lo, hi = self.fields[i]
+        return lo + values[i] * (hi - lo) / ((1 << bits) - 1)
+
+##
+# Interest classes a client's update periods are given for
+CLASS_SUBSCRIBED = 0
+CLASS_REGION = 1
+CLASS_OTHER = 2
+
+##
+# Update periods from a client's RATES frame, counted in that client's
+# round trips, and its per round trip budget in bytes (0 for none)
+class Rates:
+    def __init__(self, classes: Tuple[int, int, int], budget: int, uids: Dict[int, int]):
+        self.classes: Tuple[int, int, int] = classes
+        self.budget: int = budget
+        self.uids: Dict[int, int] = uids
+
+    def period(self, uid: int, cls: int) -> int:
+        return max(1, self.uids.get(uid, self.classes[cls]))
+
+##
+# What the server remembers about one framed connection
+class Connection:
+    def __init__(self, flatsize: int, channel: int = 0):
+        # channels of a connection are Connections of their own on one socket
+        self.channel: int = channel
+        # UIDs of the client's entities, a plain client has one
+        self.uids: List[int] = []
+        self.flatsize: int = flatsize
+        self.key_offset: Optional[int] = None
+        # with a schema, the client's fields and which of them hold the key
+        self.schema: Optional[Schema] = None
+        # fields of each entity
+        self.values: List[List[int]] = []
+        self.key_fields: Optional[Tuple[int, int]] = None
+        # UID: fields as this client last got them
+        self.seen: Dict[int, Tuple[int, ...]] = {}
+        self.interest: Optional[Interest] = None
+        self.rates: Optional[Rates] = None
+        self.tick: int = 0
+        # UID: tick its record was last sent on
+        self.last_sent: Dict[int, int] = {}
+        # smallest SNAPSHOT to delta code, 0 if the client did not ask
+        self.delta_min: int = 0
+        self.sized: bool = False
+        # snapshots go by multicast, unless the client asked for a repair
+        self.multicast: bool = False
+        self.repair: bool = False
+        self.state_prev: bytes = b""
+        self.snapshot_prev: bytes = b""
+        # MESSAGES entries other handler threads queued for this client
+        self.inbox: Deque[bytes] = collections.deque()
+
+    ##
+    # The first entity's UID, that of a relay's first local entity there is
+    @property
+    def uid(self) -> int:
+        return next((uid for uid in self.uids if uid), 0)
+
+    ##
+    # A frame on this channel
+    def frame(self, ftype: int, payload: bytes) -> bytes:
+        return frame(ftype | self.channel << FRAME_CHANNEL_SHIFT, payload)
+
+    ##
+    # Header and payload of a frame on this channel, left apart so a big
+    # payload is not copied just to put 8 bytes in front of it
+    def parts(self, ftype: int, payload: bytes) -> Tuple[bytes, bytes]:
+        return struct.pack("<II", ftype | self.channel << FRAME_CHANNEL_SHIFT, len(payload)), payload
+
+    ##
+    # A frame for the wire as its parts, SNAPSHOT delta coded against the last
+    # one when it pays
+    def encode(self, ftype: int, payload: bytes) -> Tuple[bytes, bytes]:
+        if ftype != FRAME_SNAPSHOT or self.delta_min == 0:
+            return self.parts(ftype, payload)
+
+        prev = self.snapshot_prev
+        self.snapshot_prev = payload
+        if len(payload) >= self.delta_min:
+            packed = delta_encode(payload, prev)
+            if len(packed) < len(payload):
+                return self.parts(ftype | FRAME_DELTA, packed)
+        return self.parts(ftype, payload)
+
+    ##
+    # A frame off the wire, raise ValueError if it cannot be decoded
+    def decode(self, ftype: int, payload: bytes) -> Tuple[int, bytes]:
+        if ftype & FRAME_DELTA:
+            ftype &= ~FRAME_DELTA
+            if ftype not in (FRAME_STATE, FRAME_STATES) or self.delta_min == 0:
+                raise ValueError("unexpected delta frame")
+            payload = delta_decode(payload, self.state_prev)
+
+        if ftype in (FRAME_STATE, FRAME_STATES) and self.delta_min:
+            self.state_prev = payload
+        return ftype, payload
+
+##
+# Replies waiting on a non-blocking socket. Control frames are always sent,
+# while only the newest snapshot is kept: a snapshot still waiting when the
+# next one is offered is dropped, so a slow client costs at most one
+# snapshot in flight and one waiting
+class Outbox:
+    def __init__(self, sock: socket.socket, queue_max: int, record: Optional[Callable[[List[bytes]], None]] = None):
+        self.sock: socket.socket = sock
+        # called with the buffers of whole frames as they are committed to pending
+        self.record = record
+        # most unsent bytes in the kernel before the client counts as behind
+        self.queue_max: int = queue_max
+        # being written, must be finished before anything else goes out. The
+        # payloads are the snapshots' own, gathered by sendmsg where there is
+        # one instead of copied into a single buffer
+        self.pending: Deque[memoryview] = collections.deque()
+        self.latest: Optional[List[Tuple[Connection, int, bytes]]] = None
+        # time.monotonic() since the client is behind, None while it keeps up
+        self.behind_since: Optional[float] = None
+        self.dropped: int = 0
+
+    def send(self, data: bytes):
+        if self.record:
+            self.record([data])
+        self.pending.append(memoryview(data))
+
+    ##
+    # Queue the (channel, type, payload) frames of a snapshot, return True if
+    # they replaced some that were never sent. The channels code them as they
+    # are committed, so dropped ones never reach a dictionary
+    def offer(self, snapshot: List[Tuple[Connection, int, bytes]]) -> bool:
+        dropped = self.latest is not None
+        if dropped:
+            self.dropped += 1
+        self.latest = snapshot
+        return dropped
+
+    def waiting(self) -> bool:
+        return bool(self.pending) or self.latest is not None
+
+    ##
+    # Write as much as the socket takes without blocking, raise OSError if
+    # the connection broke
+    def flush(self):
+        while True:
+            if not self.pending:
+                if self.latest is None:
+                    break
+                parts = [part for conn, ftype, payload in self.latest for part in conn.encode(ftype, payload)]
+                self.latest = None
+                if self.record:
+                    self.record(parts)
+                # an empty view would never be written off
+                self.pending.extend(memoryview(part) for part in parts if part)
+            try:
+                sent = self._write()
+            except (BlockingIOError, InterruptedError):
+                break
+            self._written(sent)
+
+        behind = self.waiting() or send_queue(self.sock) > self.queue_max
+        if not behind:
+            self.behind_since = None
+        elif self.behind_since is None:
+            self.behind_since = time.monotonic()
+
+    def _write(self) -> int:
+        if hasattr(self.sock, "sendmsg"):
+            return self.sock.sendmsg(list(itertools.islice(self.pending, SENDMSG_MAX)))
+        # Windows, one buffer at a time
+        return self.sock.send(self.pending[0])
+
+    ##
+    # Drop the sent bytes off the front of pending
+    def _written(self, sent: int):
+        while sent:
+            head = self.pending[0]
+            if len(head) > sent:
+                self.pending[0] = head[sent:]
+                break
+            sent -= len(head)
+            self.pending.popleft()
+
+##
+# Uniform grid over the clients' float[2] keys, so a region query only looks
+# at the clients near it
+class Grid:
+    def __init__(self, cell: float):
+        self.cell: float = cell
+        self.cells: Dict[Tuple[int, int], Set[int]] = {}
+        # UID: x, y, cell
+        self.keys: Dict[int, Tuple[float, float, Tuple[int, int]]] = {}
+
+    def _cell(self, x: float, y: float) -> Tuple[int, int]:
+        return (math.floor(x / self.cell), math.floor(y / self.cell))
+
+    def update(self, uid: int, x: float, y: float):
+        if not (math.isfinite(x) and math.isfinite(y)):
+            self.remove(uid)
+            return
+
+        cell = self._cell(x, y)
+        old = self.keys.get(uid)
+        if old is None or old[2] != cell:
+            if old is not None:
+                self._discard(uid, old[2])
+            self.cells.setdefault(cell, set()).add(uid)
+        self.keys[uid] = (x, y, cell)
+
+    def remove(self, uid: int):
+        old = self.keys.pop(uid, None)
+        if old is not None:
+            self._discard(uid, old[2])
+
+    def _discard(self, uid: int, cell: Tuple[int, int]):
+        members = self.cells[cell]
+        members.discard(uid)
+        if not members:
+            del self.cells[cell]
+
+    ##
+    # UIDs whose key lies inside the region, bounds inclusive
+    def query(self, x0: float, y0: float, x1: float, y1: float) -> List[int]:
+        candidates: Iterable[int]
+        if all(math.isfinite(v) for v in (x0, y0, x1, y1)):
+            c0 = self._cell(x0, y0)
+            c1 = self._cell(x1, y1)
+            count = (c1[0] - c0[0] + 1) * (c1[1] - c0[1] + 1)
+        else:
+            count = len(self.keys) + 1
+
+        # visiting cells only pays off while there are fewer of them than clients
+        if count > len(self.keys):
+            candidates = list(self.keys)
+        else:
+            candidates = []
+            for cx in range(c0[0], c1[0] + 1):
+                for cy in range(c0[1], c1[1] + 1):
+                    candidates.extend(self.cells.get((cx, cy), ()))
+
+        rv = []
+        for uid in candidates:
+            x, y, _ = self.keys[uid]
+            if x0 <= x <= x1 and y0 <= y <= y1:
+                rv.append(uid)
+        return rv
+
+##
+# Per-thread ring buffers of phase begin/end events, dumped as Chrome trace
+# JSON for chrome://tracing or ui.perfetto.dev. Mirrors acs_trace.c
+class Trace:
+    def __init__(self, path: str, capacity: int = 65536):
+        self.path: str = path
+        self.capacity: int = capacity
+        self.rings: Dict[int, Deque[Tuple[str, str, int]]] = {}
+        self.local = threading.local()
+
+    def _ring(self) -> Deque[Tuple[str, str, int]]:
+        ring = getattr(self.local, "ring", None)
+        if ring is None:
+            ring = collections.deque(maxlen=self.capacity)
+            self.local.ring = ring
+            self.rings[threading.get_ident()] = ring
+        return ring
+
+    def begin(self, name: str):
+        self._ring().append((name, "B", time.perf_counter_ns() // 1000))
+
+    def end(self, name: str):
+        self._ring().append((name, "E", time.perf_counter_ns() // 1000))
+
+    ##
+    # Write every thread's ring to self.path
+    def dump(self):
+        pid = os.getpid()
+        events = []
+        for tid, ring in list(self.rings.items()):
+            for name, ph, ts in list(ring):
+                events.append({"name": name, "ph": ph, "ts": ts, "pid": pid, "tid": tid})
+        with open(self.path, "w") as fp:
+            json.dump({"traceEvents": events, "displayTimeUnit": "ms"}, fp)
+
+##
+# Stand-in when tracing is off so call sites need no checks
+class NullTrace:
+    def begin(self, name: str):
+        pass
+
+    def end(self, name: str):
+        pass
+
+    def dump(self):
+        pass
+
+##
+# Append every frame of the framed connections to memory mapped segment files
+# path.000000, path.000001, ... for acs_replay.py. Mirrors acs_record.c
+class Recorder:
+    def __init__(self, path: str, segment_size: int = RECORD_SEGMENT):
+        self.path: str = path
+        self.segment_size: int = max(segment_size, RECORD_HEADER + RECORD_ENTRY)
+        self.segment: int = 0
+        # the handler threads all write here
+        self.lock = threading.Lock()
+        self.conns: int = 0
+        self.fp = None
+        self.map: Optional[mmap.mmap] = None
+        self.used: int = 0
+        self._open(self.segment_size)
+
+    def _open(self, size: int):
+        self.fp = open(f"{self.path}.{self.segment:06d}", "w+b")
+        self.fp.truncate(size)
+        self.map = mmap.mmap(self.fp.fileno(), size)
+        struct.pack_into("<4sIII", self.map, 0, b"ACSL", RECORD_VERSION, RECORD_SERVER, 0)
+        self.used = RECORD_HEADER
+
+    ##
+    # Trim the segment to what was written
+    def _close(self):
+        self.map.close()
+        self.map = None
+        self.fp.truncate(self.used)
+        self.fp.close()
+
+    ##
+    # Id telling a new connection's entries apart
+    def conn_id(self) -> int:
+        with self.lock:
+            self.conns += 1
+            return self.conns
+
+    def put(self, conn: int, direction: int, ftype: int, payload: bytes):
+        size = len(payload)
+        need = RECORD_ENTRY + ((size + 7) & ~7)
+        with self.lock:
+            if self.map is None:
+                return
+            if self.used + need > len(self.map):
+                self._close()
+                self.segment += 1
+                self._open(max(self.segment_size, RECORD_HEADER + need))
+            # 0 ends a segment
+            struct.pack_into("<QIIII", self.map, self.used, max(1, clock_us()), conn, direction, ftype, size)
+            self.map[self.used + RECORD_ENTRY:self.used + RECORD_ENTRY + size] = payload
+            self.used += need
+
+    ##
+    # Put each frame of data, as the socket sees it, which may come in parts
+    def put_frames(self, conn: int, direction: int, data: Union[bytes, List[bytes]]):
+        if isinstance(data, list):
+            data = b"".join(data)
+        view = memoryview(data)
+        offset = 0
+        while offset + 8 <= len(view):
+            ftype, size = struct.unpack_from("<II", view, offset)
+            self.put(conn, direction, ftype, view[offset + 8:offset + 8 + size])
+            offset += 8 + size
+
+    def close(self):
+        with self.lock:
+            if self.map is not None:
+                self._close()
+
+##
+# Stand-in when recording is off
+class NullRecorder:
+    def conn_id(self) -> int:
+        return 0
+
+    def put(self, conn: int, direction: int, ftype: int, payload: bytes):
+        pass
+
+    def put_frames(self, conn: int, direction: int, data: Union[bytes, List[bytes]]):
+        pass
+
+    def close(self):
+        pass
+
+##
+# The clients of one channel id, with UIDs of their own. Legacy clients and
+# the connections themselves are on channel 0
+class Channel:
+    def __init__(self, grid_cell: float, uid_base: int = 0, uid_stride: int = 1):
         # UID: Raw flatdata as bytes
         self.clients: Dict[int, bytes] = {}
+        # UID: clock_us() when its flatdata arrived
+        self.stamps: Dict[int, int] = {}
+        # UID: schema and field values of clients with a schema
+        self.fields: Dict[int, Tuple[Schema, Tuple[int, ...]]] = {}
         self.uid_reuse: List[int] = []
-        self.uid_current: int = 1
-        self.host: str = host
-        self.port: int = port
-        self.flatsize: int = flatsize
-        self.max_clients: int = max_clients
+        # a federation's servers interleave UIDs, so they stay small enough
+        # for clients' max_clients
+        self.uid_stride: int = uid_stride
+        self.uid_current: int = uid_base if uid_base > 0 else uid_stride
+        # UIDs of other servers' clients, see Link
+        self.remote: Set[int] = set()
+        # UID: Connection of the client whose entity it is, for messages
+        self.owners: Dict[int, Connection] = {}
+        # the last tick published to the multicast group, 0 for none
+        self.tick: int = 0
+        # interest management, handler threads share the grid
+        self.grid: Grid = Grid(grid_cell)
+        self.lock = threading.Lock()
 
     ##
     # Get the next available UID
@@ -28,16 +647,406 @@ class AcsSync:
             return rv
 
         rv = self.uid_current
-        self.uid_current += 1
+        self.uid_current += self.uid_stride
         return rv
 
     ##
     # Delete the given UID
     def uid_del(self, uid: int):
+        if uid == 0:
+            return
+
         if not uid in self.uid_reuse:
             self.uid_reuse.append(uid)
+            self.client_del(uid)
+
+    ##
+    # Forget the flatdata of uid, without giving the UID out again
+    def client_del(self, uid: int):
+        self.clients.pop(uid, None)
+        self.stamps.pop(uid, None)
+        self.fields.pop(uid, None)
+        self.remote.discard(uid)
+        with self.lock:
+            self.grid.remove(uid)
+            self.owners.pop(uid, None)
+
+    ##
+    # Queue each message of a MESSAGES payload from conn for whoever it is to,
+    # with conn's UID as the sender unless it names another of conn's own, as
+    # a relay does for its local clients
+    def route(self, conn: Connection, payload: bytes):
+        offset = 0
+        while offset < len(payload):
+            sender, to, size = struct.unpack_from("<III", payload, offset)
+            offset += 12
+            if offset + size > len(payload):
+                raise ValueError("short MESSAGES")
+            if sender == 0 or sender not in conn.uids:
+                sender = conn.uid
+            message = struct.pack("<III", sender, to, size) + payload[offset:offset + size]
+            offset += size
+
+            with self.lock:
+                if to == 0:
+                    # a client with several entities gets a broadcast once
+                    targets = list({id(c): c for c in self.owners.values() if c is not conn}.values())
+                else:
+                    target = self.owners.get(to)
+                    targets = [target] if target is not None else []
+            for target in targets:
+                target.inbox.append(message)
+
+    ##
+    # Save the flatdata of uid, which arrived at time recv_time and has its
+    # position at key if that is not None
+    def client_set(self, uid: int, data: bytes, recv_time: int, key: Optional[Tuple[float, float]] = None):
+        self.stamps[uid] = recv_time
+        self.clients[uid] = data
+
+        if key is not None:
+            with self.lock:
+                self.grid.update(uid, *key)
+
+    ##
+    # UIDs conn may see, with the interest class of each
+    def visible(self, conn: Connection) -> Dict[int, int]:
+        interest = conn.interest
+        if interest is None:
+            return dict.fromkeys(self.clients, CLASS_OTHER)
+
+        rv = {}
+        if interest.region is not None:
+            with self.lock:
+                rv = dict.fromkeys(self.grid.query(*interest.region), CLASS_REGION)
+        rv.update(dict.fromkeys(interest.uids, CLASS_SUBSCRIBED))
+        return rv
+
+    ##
+    # KEEP and SNAPSHOT (type, payload) frames for conn, records cut or padded to its flatsize.
+    # With rates, only clients whose period is up are sent, within budget, the
+    # rest are listed in KEEP
+    def snapshot(self, conn: Connection, recv_time: int) -> List[Tuple[int, bytes]]:
+        conn.tick += 1
+        visible = self.visible(conn)
+        for uid in conn.uids:
+            visible.pop(uid, None)
+
+        rates = conn.rates
+        keep = []
+        if rates is None:
+            selected = list(visible)
+        else:
+            due = []
+            for client_uid, cls in visible.items():
+                last = conn.last_sent.get(client_uid)
+                if last is None or conn.tick - last >= rates.period(client_uid, cls):
+                    due.append((rates.period(client_uid, cls), -1 if last is None else last, client_uid))
+                elif client_uid in self.clients:
+                    keep.append(client_uid)
+            due.sort()
+
+            # most urgent first, whatever does not fit waits for the next round trip
+            selected = [client_uid for _, _, client_uid in due]
+            if rates.budget > 0:
+                record_size = 8 + (conn.schema.size if conn.schema else conn.flatsize + 4 * conn.sized)
+                fits = max(1, rates.budget // record_size)
+                keep.extend(client_uid for client_uid in selected[fits:] if client_uid in conn.last_sent)
+                selected = selected[:fits]
 
-            del self.clients[uid]
+            last_sent = {client_uid: conn.last_sent[client_uid]
+                         for client_uid in visible if client_uid in conn.last_sent}
+            for client_uid in selected:
+                last_sent[client_uid] = conn.tick
+            conn.last_sent = last_sent
+
+        records = []
+        for client_uid in selected:
+            if conn.schema is not None:
+                # only the fields this client does not have yet
+                schema, values = self.fields.get(client_uid, (None, None))
+                if schema != conn.schema:
+                    continue
+                data = client_uid.to_bytes(4, byteorder='little') + schema.encode(values, conn.seen.get(client_uid))
+                conn.seen[client_uid] = values
+            else:
+                data = self.clients.get(client_uid)
+                if data is None or client_uid in self.fields:
+                    continue
+                if conn.sized:
+                    data = struct.pack("<I", min(len(data), conn.flatsize)) + data[:conn.flatsize]
+                elif len(data) != conn.flatsize:
+                    data = data[:conn.flatsize].ljust(conn.flatsize, b"\0")
+            records.append(struct.pack("<q", self.stamps.get(client_uid, recv_time)))
+            records.append(data)
+
+        # the client forgets whoever is in neither, so must we
+        if conn.seen:
+            kept = set(selected).union(keep)
+            conn.seen = {client_uid: values for client_uid, values in conn.seen.items() if client_uid in kept}
+
+        header = struct.pack("<IIqq", conn.uid, len(records) // 2, recv_time, clock_us())
+        rv = [(FRAME_SNAPSHOT, header + b"".join(records))]
+        if keep:
+            rv.insert(0, (FRAME_KEEP, struct.pack(f"<{len(keep)}I", *keep)))
+        return rv
+
+    ##
+    # SNAPSHOT payload of everyone without a schema for every client at once,
+    # published to the multicast group. Records are sized, with no UID or
+    # recv_time in the header, each client's TICK has those
+    def shared(self) -> bytes:
+        records = []
+        for client_uid, data in list(self.clients.items()):
+            if client_uid in self.fields:
+                continue
+            records.append(struct.pack("<qI", self.stamps.get(client_uid, 0), len(data)))
+            records.append(data)
+        return struct.pack("<IIqq", 0, len(records) // 2, 0, clock_us()) + b"".join(records)
+
+##
+# A connection to another server, either end sends the other its clients
+# every peer_interval seconds, without those it got from that server, so
+# servers linked in a tree see everyone. Each record goes with how old it
+# is, so no two clocks need to agree, and messages are routed on. Clients
+# with a schema stay on their server
+class Link:
+    def __init__(self, sync: "AcsSync", sock: socket.socket, name: str):
+        self.sync = sync
+        self.sock: socket.socket = sock
+        self.name: str = name
+        # the peer's clients on each channel, as a Connection owning their UIDs
+        self.conns: Dict[int, Connection] = {}
+
+    def conn(self, channel_id: int) -> Connection:
+        rv = self.conns.get(channel_id)
+        if rv is None:
+            rv = self.conns[channel_id] = Connection(0, channel_id)
+        return rv
+
+    ##
+    # Serve the link until it breaks, then forget the peer's clients
+    def run(self, dialed: bool):
+        sync = self.sync
+        out = Outbox(self.sock, sync.slow_queue)
+        inbuf = bytearray()
+        due = time.monotonic()
+
+        self.sock.setblocking(False)
+        self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        out.send(frame(FRAME_HELLO, struct.pack("<III", PROTOCOL_VERSION, FEATURE_PEER, sync.flatsize)))
+        print(f"peer {self.name}: linked{' to' if dialed else ''}", file=sys.stderr)
+
+        try:
+            while True:
+                now = time.monotonic()
+                if now >= due:
+                    self.offer(out)
+                    due = max(due + sync.peer_interval, now)
+                if out.behind_since is not None and now - out.behind_since > sync.slow_timeout:
+                    print(f"peer {self.name}: behind for {sync.slow_timeout}s", file=sys.stderr)
+                    break
+
+                readable, _, _ = select.select([self.sock], [self.sock] if out.waiting() else [], [],
+                                               max(0.0, due - time.monotonic()))
+                if readable:
+                    try:
+                        chunk = self.sock.recv(1 << 20)
+                    except (BlockingIOError, InterruptedError):
+                        chunk = None
+                    if chunk is not None and not chunk:
+                        break
+                    if chunk:
+                        inbuf += chunk
+
+                while len(inbuf) >= 8:
+                    ftype, size = struct.unpack_from("<II", inbuf)
+                    if size > FRAME_MAX:
+                        raise ValueError("frame too large")
+                    if len(inbuf) < 8 + size:
+                        break
+                    payload = bytes(inbuf[8:8 + size])
+                    del inbuf[:8 + size]
+                    self.apply(ftype, payload)
+                out.flush()
+        except (OSError, ValueError, struct.error) as e:
+            print(f"peer {self.name}: {e}", file=sys.stderr)
+        finally:
+            for channel_id, conn in self.conns.items():
+                channel = sync.channel(channel_id)
+                for uid in conn.uids:
+                    channel.client_del(uid)
+            print(f"peer {self.name}: unlinked", file=sys.stderr)
+
+    ##
+    # Queue our clients for the peer, in place of any it has not taken yet,
+    # and the messages for its clients
+    def offer(self, out: Outbox):
+        with self.sync.channels_lock:
+            channels = list(self.sync.channels.items())
+
+        frames = []
+        for channel_id, channel in channels:
+            conn = self.conn(channel_id)
+            if conn.inbox:
+                messages = []
+                while conn.inbox:
+                    messages.append(conn.inbox.popleft())
+                out.send(conn.frame(FRAME_MESSAGES, b"".join(messages)))
+
+            theirs = set(conn.uids)
+            with channel.lock:
+                keys = {uid: key[:2] for uid, key in channel.grid.keys.items()}
+            now = clock_us()
+            records = []
+            for uid, data in list(channel.clients.items()):
+                if uid in theirs or uid in channel.fields:
+                    continue
+                x, y = keys.get(uid, (math.nan, math.nan))
+                records.append(struct.pack("<ffqI", x, y, now - channel.stamps.get(uid, now), len(data)))
+                records.append(data)
+            frames.append((conn, FRAME_PEER, struct.pack("<I", len(records) // 2) + b"".join(records)))
+        out.offer(frames)
+
+    def apply(self, ftype: int, payload: bytes):
+        channel_id, ftype = frame_channel(ftype)
+        if ftype == FRAME_HELLO:
+            version, features, _ = struct.unpack_from("<III", payload)
+            if version != PROTOCOL_VERSION or not features & FEATURE_PEER:
+                raise ValueError("not a peer")
+            return
+
+        channel = self.sync.channel(channel_id)
+        conn = self.conn(channel_id)
+        if ftype == FRAME_MESSAGES:
+            channel.route(conn, payload)
+
+        elif ftype == FRAME_PEER:
+            recv_time = clock_us()
+            count, = struct.unpack_from("<I", payload)
+            offset = 4
+            uids = []
+            for _ in range(count):
+                x, y, age, size = struct.unpack_from("<ffqI", payload, offset)
+                offset += 20
+                data = payload[offset:offset + size]
+                offset += size
+                if len(data) != size or size < 4:
+                    raise ValueError("short PEER")
+                uid = int.from_bytes(data[:4], byteorder='little')
+
+                # ours, or had first over another link, which only a cycle
+                # of links or two servers with the same --id would cause
+                with channel.lock:
+                    owner = channel.owners.get(uid)
+                    if (owner is not None and owner is not conn) or (uid in channel.clients and uid not in channel.remote):
+                        continue
+                    channel.owners[uid] = conn
+                channel.remote.add(uid)
+                channel.client_set(uid, data, recv_time - max(0, age), (x, y))
+                uids.append(uid)
+
+            for uid in set(conn.uids).difference(uids):
+                channel.client_del(uid)
+            conn.uids = uids
+
+class AcsSync:
+    def __init__(self, host: str, port: int, flatsize: int, max_clients: int):
+        self.host: str = host
+        self.port: int = port
+        self.flatsize: int = flatsize
+        self.max_clients: int = max_clients
+        self.trace = NullTrace()
+        self.recorder = NullRecorder()
+        # federation, this server hands out UIDs uid_base + k * uid_stride
+        # and every peer_interval seconds each Link sends its peer our clients
+        self.uid_base: int = 0
+        self.uid_stride: int = 1
+        self.peers: List[Tuple[str, int]] = []
+        self.peer_interval: float = 0.02
+        # (group, port) each tick_interval seconds channel 0's SNAPSHOT is
+        # published to for clients with FEATURE_MULTICAST, sent out of the
+        # interface with address multicast_if, "" for the one the routes pick
+        self.multicast: Optional[Tuple[str, int]] = None
+        self.multicast_if: str = ""
+        self.tick_interval: float = 0.02
+        # cell size of each channel's interest management grid
+        self.grid_cell: float = 64.0
+        # channel id: its clients, made as clients open them
+        self.channels: Dict[int, Channel] = {}
+        self.channels_lock = threading.Lock()
+        # slow consumers, a client behind for slow_timeout seconds is dropped
+        self.slow_queue: int = 256 << 10
+        self.slow_timeout: float = 2.0
+        # smallest SNAPSHOT worth delta coding for clients that ask
+        self.delta_min: int = 1024
+
+    ##
+    # Record handler phases into per-thread rings, dumped to @path on SIGUSR1
+    # and when the server stops
+    def trace_to(self, path: str):
+        self.trace = Trace(path)
+        if hasattr(signal, "SIGUSR1"):
+            signal.signal(signal.SIGUSR1, lambda signum, frame: self.trace.dump())
+
+    ##
+    # Log every frame framed clients send and receive to @path.000000, ...
+    def record_to(self, path: str, segment_size: int = RECORD_SEGMENT):
+        self.recorder = Recorder(path, segment_size)
+
+    ##
+    # The clients on channel id
+    def channel(self, channel_id: int) -> Channel:
+        with self.channels_lock:
+            rv = self.channels.get(channel_id)
+            if rv is None:
+                rv = Channel(self.grid_cell, self.uid_base, self.uid_stride)
+                self.channels[channel_id] = rv
+            return rv
+
+    ##
+    # Keep a Link to the server at address, dialing again when it breaks
+    def peer_dial(self, address: Tuple[str, int]):
+        while True:
+            try:
+                sock = socket.create_connection(address)
+            except OSError:
+                time.sleep(PEER_RETRY)
+                continue
+            Link(self, sock, f"{address[0]}:{address[1]}").run(True)
+            sock.close()
+            time.sleep(PEER_RETRY)
+
+    ##
+    # Publish channel 0's SNAPSHOT to the multicast group every tick, one
+    # send per datagram however many clients get it
+    def publish(self):
+        group, port = self.multicast
+        sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM, socket.IPPROTO_UDP)
+        sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_TTL, 1)
+        if self.multicast_if:
+            sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_IF, socket.inet_aton(self.multicast_if))
+        channel = self.channel(0)
+        tick = 0
+        deadline = time.monotonic()
+
+        while True:
+            deadline += self.tick_interval
+            time.sleep(max(0.0, deadline - time.monotonic()))
+            if not channel.clients:
+                continue
+
+            payload = channel.shared()
+            tick = tick % 0xffffffff + 1
+            try:
+                for index, offset in enumerate(range(0, len(payload), MULTICAST_PART)):
+                    sock.sendto(struct.pack("<IIII", MULTICAST_MAGIC, tick, index, len(payload))
+                                + payload[offset:offset + MULTICAST_PART], (group, port))
+            except OSError as e:
+                print(f"multicast: {e}", file=sys.stderr)
+                continue
+            # only now may a TICK name it
+            channel.tick = tick
 
     ##
     # Start the server, this function won't return
@@ -47,21 +1056,283 @@ class AcsSync:
 
             def handle(self):
                 this = AcsTcpHandler.thisref
-                uid = 0
-                tmp = 0
+                trace = this.trace
+
+                self.request.setblocking(True)
+
+                # framed clients always open with a HELLO, older ones with flatdata
+                try:
+                    magic = self.request.recv(4, socket.MSG_PEEK | socket.MSG_WAITALL)
+                    framed = int.from_bytes(magic, byteorder='little') == FRAME_HELLO
+                    hello = self.request.recv(20, socket.MSG_PEEK | socket.MSG_WAITALL) if framed else b""
+                except OSError:
+                    return
+
+                # another server, whose clients do not count against ours
+                if len(hello) == 20 and struct.unpack_from("<III", hello, 8)[1] & FEATURE_PEER:
+                    Link(this, self.request, self.client_address[0]).run(False)
+                    return
 
                 # don't accept if too many clients
-                if len(this.clients) >= this.max_clients:
+                channel = this.channel(0)
+                if len(channel.clients) - len(channel.remote) >= this.max_clients:
                     return
 
-                self.request.setblocking(True)
+                if framed:
+                    conns = self.framed(this)
+                else:
+                    conns = [Connection(this.flatsize)]
+                    conns[0].uids.append(self.legacy(this))
+
+                # all of a client's entities leave with it, on every channel
+                trace.begin("uid_del")
+                for conn in conns:
+                    channel = this.channel(conn.channel)
+                    for uid in conn.uids:
+                        channel.uid_del(uid)
+                trace.end("uid_del")
+
+            ##
+            # Serve a client speaking the framed protocol until it leaves,
+            # return the Connection of each of its channels
+            def framed(self, this) -> List[Connection]:
+                trace = this.trace
+                sock = self.request
+                conns = {0: Connection(this.flatsize)}
+                conn = conns[0]
+                recorder = this.recorder
+                conn_id = recorder.conn_id()
+                out = Outbox(sock, this.slow_queue, lambda data: recorder.put_frames(conn_id, RECORD_SEND, data))
+                inbuf = bytearray()
+                # the channels' snapshots so far this round trip, offered with channel 0's
+                self.round: List[Tuple[Connection, int, bytes]] = []
+
+                # never block on a client, one that stops reading is cut off
+                # instead of holding this thread and its snapshots
+                sock.setblocking(False)
 
                 while True:
+                    timeout = None
+                    if out.behind_since is not None:
+                        left = out.behind_since + this.slow_timeout - time.monotonic()
+                        if left <= 0:
+                            print(f"uid {conn.uid}: behind for {this.slow_timeout}s, "
+                                  f"{out.dropped} snapshots dropped, disconnecting", file=sys.stderr)
+                            break
+                        # the kernel queue drains without waking select, so poll it
+                        timeout = min(left, 0.05)
+
+                    try:
+                        readable, writable, _ = select.select([sock], [sock] if out.waiting() else [], [], timeout)
+                    except (OSError, ValueError):
+                        break
+
+                    trace.begin("recv")
+                    try:
+                        chunk = sock.recv(65536) if readable else None
+                    except (BlockingIOError, InterruptedError):
+                        chunk = None
+                    except OSError:
+                        chunk = b""
+                    trace.end("recv")
+                    if chunk is not None and not chunk:
+                        break
+                    if chunk:
+                        inbuf += chunk
+
+                    try:
+                        while len(inbuf) >= 8:
+                            ftype, size = struct.unpack_from("<II", inbuf)
+                            if size > FRAME_MAX:
+                                raise ValueError("frame too large")
+                            if len(inbuf) < 8 + size:
+                                break
+                            payload = bytes(inbuf[8:8 + size])
+                            del inbuf[:8 + size]
+                            recorder.put(conn_id, RECORD_RECV, ftype, payload)
+                            self.frame_apply(this, conns, out, ftype, payload)
+
+                        trace.begin("send")
+                        try:
+                            out.flush()
+                        finally:
+                            trace.end("send")
+                    except (OSError, ValueError, struct.error):
+                        break
+
+                return list(conns.values())
+
+            ##
+            # Save the STATE payload of conn's entity at index, return whether
+            # it got a new UID. An empty one is gone, a relay's local client
+            # that left, and the next one there gets a new UID
+            def entity_set(self, channel: Channel, conn: Connection, index: int, payload: bytes, recv_time: int) -> bool:
+                if not payload:
+                    if index < len(conn.uids) and conn.uids[index]:
+                        channel.uid_del(conn.uids[index])
+                        conn.uids[index] = 0
+                    return False
+
+                # need to assign a UID to this new entity, who may not know it yet
+                assigned = False
+                while len(conn.uids) <= index:
+                    conn.uids.append(0)
+                    if conn.schema is not None:
+                        conn.values.append([0] * len(conn.schema.widths))
+                if conn.uids[index] == 0:
+                    conn.uids[index] = channel.uid_get()
+                    if conn.schema is not None:
+                        conn.values[index] = [0] * len(conn.schema.widths)
+                    assigned = True
+
+                uid = conn.uids[index]
+                data = uid.to_bytes(4, byteorder='little') + payload[4:conn.flatsize]
+                if assigned:
+                    with channel.lock:
+                        channel.owners[uid] = conn
+
+                key = None
+                if conn.schema is not None:
+                    values = conn.values[index]
+                    conn.schema.decode(payload[4:], values)
+                    channel.fields[uid] = (conn.schema, tuple(values))
+                    if conn.key_fields is not None:
+                        key = (conn.schema.real(values, conn.key_fields[0]),
+                               conn.schema.real(values, conn.key_fields[1]))
+                elif conn.key_offset is not None and conn.key_offset + 8 <= len(data):
+                    key = struct.unpack_from("<ff", data, conn.key_offset)
+                channel.client_set(uid, data, recv_time, key)
+                return assigned
+
+            ##
+            # Act on one frame from a framed client, queueing any reply in out
+            def frame_apply(self, this, conns: Dict[int, Connection], out: Outbox, ftype: int, payload: bytes):
+                channel_id, ftype = frame_channel(ftype)
+
+                # a channel speaks like a connection of its own, with what
+                # was agreed on in the HELLO
+                if ftype == FRAME_CHANNEL and channel_id not in conns:
+                    flatsize, = struct.unpack_from("<I", payload)
+                    conn = Connection(flatsize, channel_id)
+                    conn.delta_min = conns[0].delta_min
+                    conn.sized = conns[0].sized
+                    conns[channel_id] = conn
+                    return
+
+                conn = conns.get(channel_id)
+                if conn is None:
+                    return
+                ftype, payload = conn.decode(ftype, payload)
+
+                if ftype == FRAME_HELLO:
+                    version, features, conn.flatsize = struct.unpack_from("<III", payload)
+                    features &= FEATURES | (FEATURE_MULTICAST if this.multicast else 0)
+                    conn.multicast = bool(features & FEATURE_MULTICAST)
+                    if features & FEATURE_DELTA:
+                        conn.delta_min = max(1, this.delta_min)
+                    conn.sized = bool(features & FEATURE_SIZED)
+                    out.send(frame(FRAME_HELLO, struct.pack("<III",
+                        min(version, PROTOCOL_VERSION), features, conn.flatsize)))
+
+                elif ftype == FRAME_KEY:
+                    if conn.schema is not None:
+                        x, y = struct.unpack_from("<II", payload)
+                        count = len(conn.schema.fields)
+                        if x < count and y < count and conn.schema.fields[x][0] == conn.schema.fields[y][0] == SCHEMA_F32:
+                            conn.key_fields = (x, y)
+                    else:
+                        conn.key_offset, = struct.unpack_from("<I", payload)
+
+                elif ftype == FRAME_SCHEMA:
+                    conn.schema = Schema(payload)
+                    conn.values = [[0] * len(conn.schema.widths) for _ in conn.uids]
+
+                elif ftype == FRAME_SUBSCRIBE:
+                    has_region, x0, y0, x1, y1, count = struct.unpack_from("<I4fI", payload)
+                    uids = set(struct.unpack_from(f"<{count}I", payload, 24))
+                    if has_region or uids:
+                        conn.interest = Interest(uids, (x0, y0, x1, y1) if has_region else None)
+                    else:
+                        conn.interest = None
+
+                elif ftype == FRAME_RATES:
+                    subscribed, region, other, budget, count = struct.unpack_from("<5I", payload)
+                    pairs = struct.unpack_from(f"<{2 * count}I", payload, 20)
+                    conn.rates = Rates((subscribed, region, other), budget,
+                                       dict(zip(pairs[0::2], pairs[1::2])))
+
+                elif ftype == FRAME_MESSAGES:
+                    this.channel(conn.channel).route(conn, payload)
+
+                elif ftype == FRAME_REPAIR:
+                    conn.repair = True
+
+                elif ftype in (FRAME_STATE, FRAME_STATES):
+                    recv_time = clock_us()
+                    channel = this.channel(conn.channel)
+
+                    if ftype == FRAME_STATE:
+                        self.entity_set(channel, conn, 0, payload, recv_time)
+                    else:
+                        count, = struct.unpack_from("<I", payload)
+                        offset = 4
+                        assigned = False
+                        for index in range(count):
+                            size, = struct.unpack_from("<I", payload, offset)
+                            offset += 4
+                            if offset + size > len(payload):
+                                raise ValueError("short STATES")
+                            assigned |= self.entity_set(channel, conn, index, payload[offset:offset + size], recv_time)
+                            offset += size
+
+                        # never dropped like a snapshot, the client must learn them
+                        if assigned:
+                            out.send(conn.frame(FRAME_UIDS, struct.pack(f"<{len(conn.uids)}I", *conn.uids)))
+
+                    # never dropped like a snapshot, and ahead of the one for this STATE
+                    if conn.inbox:
+                        messages = []
+                        while conn.inbox:
+                            messages.append(conn.inbox.popleft())
+                        out.send(conn.frame(FRAME_MESSAGES, b"".join(messages)))
+
+                    # the waiting snapshot is about to be dropped, whatever it
+                    # would have sent must go in this one
+                    if out.latest is not None:
+                        conn.last_sent = {}
+                        conn.seen = {}
+
+                    # the tick everyone got stands in for the snapshot, the
+                    # client needs it unless it missed one
+                    if conn.multicast and not conn.repair and channel.tick:
+                        reply = [(FRAME_TICK, struct.pack("<IIqq", conn.uid, channel.tick, recv_time, clock_us()))]
+                    else:
+                        conn.repair = False
+                        reply = channel.snapshot(conn, recv_time)
+
+                    # channels come first, channel 0 ends the round trip
+                    self.round.extend((conn, rtype, rpayload) for rtype, rpayload in reply)
+                    if conn.channel == 0:
+                        out.offer(self.round)
+                        self.round = []
+
+            ##
+            # Serve a client sending bare flatdata until it leaves, return its UID
+            def legacy(self, this) -> int:
+                trace = this.trace
+                channel = this.channel(0)
+                uid = 0
+                tmp = 0
+
+                while True:
+                    trace.begin("recv")
                     try:
                         self.data = self.request.recv(this.flatsize)
                         #print(self.data)
                     except:
+                        trace.end("recv")
                         break
+                    trace.end("recv")
 
                     # disconnected
                     if len(self.data) == 0:
@@ -72,34 +1343,51 @@ class AcsSync:
 
                     # need to assign a UID to this new user
                     if tmp == 0:
-                        uid = this.uid_get()
+                        uid = channel.uid_get()
 
                     #print(uid, self.data)
 
                     # save the client
-                    this.clients[uid] = self.data
+                    channel.client_set(uid, self.data, clock_us())
 
-                    #print(this.clients)
+                    #print(channel.clients)
 
                     # construct header, 2 uint32's
-                    header = struct.pack("II", uid, len(this.clients) - 1)
+                    header = struct.pack("II", uid, len(channel.clients) - 1)
 
+                    trace.begin("send")
                     try:
+                        # a client that stops reading for slow_timeout is dropped
+                        self.request.settimeout(this.slow_timeout)
+
                         # send the header
                         self.request.sendall(header)
 
                         # send each client who isn't this one
-                        for client_uid, data in this.clients.items():
+                        for client_uid, data in list(channel.clients.items()):
                             if client_uid != uid:
                                 self.request.sendall(data)
+
+                        self.request.settimeout(None)
                     except:
+                        trace.end("send")
                         break
+                    trace.end("send")
 
-                this.uid_del(uid)
+                return uid
             # end handle
         # end class
+        for peer in self.peers:
+            threading.Thread(target=self.peer_dial, args=(peer,), daemon=True).start()
+        if self.multicast:
+            threading.Thread(target=self.publish, daemon=True).start()
+
         with socketserver.ThreadingTCPServer((self.host, self.port), AcsTcpHandler) as server:
-            server.serve_forever()
+            try:
+                server.serve_forever()
+            finally:
+                self.trace.dump()
+                self.recorder.close()
 
 def _arg_get(args: list, da: str, ddarg: str) -> str:
     if da in args:
@@ -120,13 +1408,26 @@ if __name__ == '__main__':
     port = 9999
     size = 64
     max_clients = 16
+    trace = None
+    grid = 64.0
+    slow_queue = None
+    slow_timeout = None
+    delta_min = None
+    record = None
+    node = 0
+    multicast = None
+    multicast_if = None
+    tick_interval = None
+    nodes = 1
+    peers = []
+    peer_interval = None
 
     if len(sys.argv) > 1:
         tmp = _arg_get(sys.argv, "-a", "--address")
         if tmp: host = tmp
 
         tmp = _arg_get(sys.argv, "-p", "--port")
-        if tmp: port = tmp
+        if tmp: port = int(tmp)
 
         tmp = _arg_get(sys.argv, "-s", "--size")
         if tmp: size = int(tmp)
@@ -134,6 +1435,49 @@ if __name__ == '__main__':
         tmp = _arg_get(sys.argv, "-c", "--connections")
         if tmp: max_clients = int(tmp)
 
+        tmp = _arg_get(sys.argv, "-t", "--trace")
+        if tmp: trace = tmp
+
+        tmp = _arg_get(sys.argv, "-g", "--grid")
+        if tmp: grid = float(tmp)
+
+        tmp = _arg_get(sys.argv, "-q", "--queue")
+        if tmp: slow_queue = int(tmp)
+
+        tmp = _arg_get(sys.argv, "-l", "--lag")
+        if tmp: slow_timeout = float(tmp)
+
+        tmp = _arg_get(sys.argv, "-z", "--compress")
+        if tmp: delta_min = int(tmp)
+
+        tmp = _arg_get(sys.argv, "-r", "--record")
+        if tmp: record = tmp
+
+        tmp = _arg_get(sys.argv, "-i", "--id")
+        if tmp: node = int(tmp)
+
+        tmp = _arg_get(sys.argv, "-n", "--nodes")
+        if tmp: nodes = int(tmp)
+
+        for i, arg in enumerate(sys.argv[:-1]):
+            if arg in ("-f", "--peer"):
+                peer_host, _, peer_port = sys.argv[i + 1].rpartition(":")
+                peers.append((peer_host or "localhost", int(peer_port)))
+
+        tmp = _arg_get(sys.argv, "-e", "--every")
+        if tmp: peer_interval = float(tmp)
+
+        tmp = _arg_get(sys.argv, "-m", "--multicast")
+        if tmp:
+            group, _, group_port = tmp.rpartition(":")
+            multicast = (group, int(group_port))
+
+        tmp = _arg_get(sys.argv, "-j", "--interface")
+        if tmp: multicast_if = tmp
+
+        tmp = _arg_get(sys.argv, "-k", "--tick")
+        if tmp: tick_interval = float(tmp)
+
         if _arg_check(sys.argv, "-h", "--help"):
             print(f"""\
 {sys.argv[0]} [OPTIONS]
@@ -143,10 +1487,56 @@ OPTIONS:
     -p; --port PORT:       Specify PORT to host at
     -s; --size SIZE:       Specify max buffer SIZE
     -c; --connections NUM: Specify max NUM of clients
+    -t; --trace FILE:      Trace handler phases, dump Chrome trace JSON to FILE
+                           on SIGUSR1 and on exit
+    -g; --grid SIZE:       Specify the cell SIZE of the interest management grid
+    -q; --queue BYTES:     Count a client as behind past BYTES unsent, default 262144
+    -l; --lag SECONDS:     Disconnect clients behind for SECONDS, default 2
+    -z; --compress BYTES:  Delta code snapshots of BYTES or more for clients
+                           that ask, default 1024
+    -r; --record PATH:     Log framed clients' frames to PATH.000000, ... for
+                           acs_replay.py
+    -i; --id NODE:         Number this server 0 to NODES - 1, unique in a
+                           federation, it hands out UIDs NODE + k * NODES
+    -n; --nodes NODES:     Specify the number of servers in the federation, default 1
+    -f; --peer HOST:PORT:  Link to the server at HOST:PORT and share clients
+                           with it, may be given more than once. Linked servers
+                           must form a tree
+    -e; --every SECONDS:   Send peers our clients every SECONDS, default 0.02
+    -m; --multicast GROUP:PORT: Publish snapshots to the IPv4 multicast GROUP
+                           on PORT for clients that join it
+    -j; --interface ADDRESS: Multicast out of the interface with ADDRESS,
+                           127.0.0.1 for loopback
+    -k; --tick SECONDS:    Publish to the multicast group every SECONDS,
+                           default 0.02
     -h; --help:            See this help
 """)
             exit(0)
 
     sync = AcsSync(host, port, size, max_clients)
+    sync.grid_cell = grid
+    if slow_queue is not None:
+        sync.slow_queue = slow_queue
+    if slow_timeout is not None:
+        sync.slow_timeout = slow_timeout
+    if delta_min is not None:
+        sync.delta_min = delta_min
+    if trace:
+        sync.trace_to(trace)
+    if record:
+        sync.record_to(record)
+    if node >= nodes:
+        print(f"--id {node} must be below --nodes {nodes}")
+        exit(1)
+    sync.uid_base = node
+    sync.uid_stride = nodes
+    sync.peers = peers
+    if peer_interval is not None:
+        sync.peer_interval = peer_interval
+    sync.multicast = multicast
+    if multicast_if:
+        sync.multicast_if = multicast_if
+    if tick_interval is not None:
+        sync.tick_interval = tick_interval
     sync.run()
     exit(0)
@@ -0,0 +1,104 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "acs.h"
+#include "acs_trace.h"
+
+struct event {
+    const char *name;
+    uint64_t ts;  // acs_time_us when the event was recorded
+    char phase;   // 'B'egin or 'E'nd, as Chrome trace expects
+};
+
+struct acs_trace {
+    struct event *events;
+    size_t capacity;
+    uint64_t count; // total events recorded, the ring index is count % capacity
+    unsigned tid;
+};
+
+static void record(struct acs_trace *self, const char *name, char phase)
+{
+    struct event *ev;
+
+    assert(self);
+    assert(name);
+
+    ev = &self->events[self->count % self->capacity];
+    ev->name = name;
+    ev->ts = acs_time_us();
+    ev->phase = phase;
+    self->count++;
+}
+
+struct acs_trace *acs_trace_new(size_t capacity, unsigned tid)
+{
+    struct acs_trace *self;
+
+    assert(capacity > 0);
+
+    self = acs_malloc(sizeof(*self));
+    if (!self) {
+        return NULL;
+    }
+
+    self->events = acs_malloc(capacity * sizeof(*self->events));
+    if (!self->events) {
+        acs_free(self);
+        return NULL;
+    }
+    self->capacity = capacity;
+    self->count = 0;
+    self->tid = tid;
+
+    return self;
+}
+
+void acs_trace_del(struct acs_trace *self)
+{
+    assert(self);
+    acs_free(self->events);
+    acs_free(self);
+}
+
+void acs_trace_begin(struct acs_trace *self, const char *name)
+{
+    record(self, name, 'B');
+}
+
+void acs_trace_end(struct acs_trace *self, const char *name)
+{
+    record(self, name, 'E');
+}
+
+int acs_trace_dump(struct acs_trace *self, FILE *fp)
+{
+    uint64_t i;
+    uint64_t first;
+    struct event *ev;
+    const char *sep = "";
+
+    assert(self);
+    assert(fp);
+
+    first = (self->count > self->capacity) ? self->count - self->capacity : 0;
+
+    // after wrapping, drop ends whose begins were overwritten
+    if (first > 0) {
+        while (first < self->count && self->events[first % self->capacity].phase != 'B') {
+            first++;
+        }
+    }
+
+    (void)fprintf(fp, "{\"traceEvents\":[");
+    for (i = first; i < self->count; i++) {
+        ev = &self->events[i % self->capacity];
+        (void)fprintf(fp, "%s\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%llu,\"pid\":1,\"tid\":%u}",
+            sep, ev->name, ev->phase, (unsigned long long)ev->ts, self->tid);
+        sep = ",";
+    }
+    (void)fprintf(fp, "\n],\"displayTimeUnit\":\"ms\"}\n");
+
+    return ferror(fp) ? 1 : 0;
+}
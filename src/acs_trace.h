@@ -0,0 +1,59 @@
+#ifndef ACS_TRACE_H
+#define ACS_TRACE_H
+
+/**
+ * Phase tracing for network threads. Compile with -DACS_TRACE to turn the
+ * ACS_TRACE_BEGIN/ACS_TRACE_END tracepoints on, otherwise they compile to
+ * nothing.
+ *
+ * Each thread owns one ring buffer of begin/end events, the oldest events
+ * are overwritten when it fills. A ring may be dumped as Chrome trace JSON
+ * to open in chrome://tracing or ui.perfetto.dev
+ */
+
+#include <stddef.h> // size_t
+#include <stdio.h>  // FILE
+
+#ifndef ACS_TRACE_CAPACITY
+#define ACS_TRACE_CAPACITY 65536 // default number of events per ring
+#endif
+
+#ifdef ACS_TRACE
+    #define ACS_TRACE_BEGIN(TRACE, NAME) acs_trace_begin((TRACE), (NAME))
+    #define ACS_TRACE_END(TRACE, NAME) acs_trace_end((TRACE), (NAME))
+#else
+    #define ACS_TRACE_BEGIN(TRACE, NAME) ((void)0)
+    #define ACS_TRACE_END(TRACE, NAME) ((void)0)
+#endif
+
+struct acs_trace;
+
+/**
+ * Create a ring holding @a capacity events for the thread named @a tid
+ * in the dump. Returns NULL on allocation failure
+ */
+struct acs_trace *acs_trace_new(size_t capacity, unsigned tid);
+
+/**
+ * Free a ring
+ */
+void acs_trace_del(struct acs_trace *self);
+
+/**
+ * Record the start/end of phase @a name, which must be a string literal or
+ * otherwise outlive the ring. Only the owning thread may call these
+ */
+void acs_trace_begin(struct acs_trace *self, const char *name);
+void acs_trace_end(struct acs_trace *self, const char *name);
+
+/**
+ * Write the ring as a Chrome trace JSON document. The owning thread must
+ * not be recording while this runs.
+ *
+ * \return
+ *       0 success
+ *       1 write error
+ */
+int acs_trace_dump(struct acs_trace *self, FILE *fp);
+
+#endif // ACS_TRACE_H
@@ -4,11 +4,39 @@
 
 #include "list.h"
 
+static void *default_alloc(size_t size, void *ctx)
+{
+	(void)ctx;
+	return malloc(size);
+}
+
+static void default_free(void *ptr, void *ctx)
+{
+	(void)ctx;
+	free(ptr);
+}
+
 struct list *list_new(void (*dtor)(void *buf))
+{
+	return list_new_with(dtor, NULL);
+}
+
+struct list *list_new_with(void (*dtor)(void *buf), const struct list_allocator *allocator)
 {
 	struct list *self;
+	struct list_allocator tmp;
+
+	if (allocator) {
+		assert(allocator->alloc && allocator->free);
+		tmp = *allocator;
+	}
+	else {
+		tmp.alloc = default_alloc;
+		tmp.free = default_free;
+		tmp.ctx = NULL;
+	}
 
-	self = malloc(sizeof(*self));
+	self = tmp.alloc(sizeof(*self), tmp.ctx);
 	if (!self) {
 		return NULL;
 	}
@@ -17,12 +45,15 @@ struct list *list_new(void (*dtor)(void *buf))
 	self->last = NULL;
 	self->size = 0;
 	self->dtor = dtor;
+	self->allocator = tmp;
 
 	return self;
 }
 
 void list_free(struct list *self)
 {
+	struct list_allocator allocator;
+
 	assert(self);
 
 	if (!self->head || self->size == 0) {
@@ -34,8 +65,9 @@ void list_free(struct list *self)
 	}
 
 cleanup:
+	allocator = self->allocator;
 	(void)memset(self, 0, sizeof(*self));
-	free(self);
+	allocator.free(self, allocator.ctx);
 }
 
 void list_remove(struct list *self, struct node *node)
@@ -59,7 +91,7 @@ void list_remove(struct list *self, struct node *node)
 			self->dtor(node->value);
 		}
 		(void)memset(node, 0, sizeof(*node));
-		free(node);
+		self->allocator.free(node, self->allocator.ctx);
 	}
 	else {
 		for (tmp = list_iter_begin(self); !list_iter_done(tmp); list_iter_continue(&tmp)) {
@@ -82,7 +114,7 @@ void list_remove(struct list *self, struct node *node)
 					self->dtor(node->value);
 				}
 				(void)memset(node, 0, sizeof(*node));
-				free(node);
+				self->allocator.free(node, self->allocator.ctx);
 				break;
 			}
 		}
@@ -135,7 +167,7 @@ struct node *list_insert_next(struct list *self, struct node *previous, void *va
 
 	assert(self);
 
-	node = malloc(sizeof(*node));
+	node = self->allocator.alloc(sizeof(*node), self->allocator.ctx);
 	if (!node) {
 		return NULL;
 	}
@@ -230,3 +262,76 @@ struct node *list_iter_next(struct node **current)
 	assert(current);
 	return (*current)->next;
 }
+
+void dlist_init(struct dlist *self)
+{
+	assert(self);
+
+	self->head.prev = &self->head;
+	self->head.next = &self->head;
+	self->size = 0;
+}
+
+void dlist_insert_next(struct dlist *self, struct dlist_node *previous, struct dlist_node *node)
+{
+	assert(self);
+	assert(previous);
+	assert(node);
+	assert(!dlist_linked(node));
+
+	node->prev = previous;
+	node->next = previous->next;
+	previous->next->prev = node;
+	previous->next = node;
+	self->size++;
+}
+
+void dlist_push_front(struct dlist *self, struct dlist_node *node)
+{
+	assert(self);
+	dlist_insert_next(self, &self->head, node);
+}
+
+void dlist_push_back(struct dlist *self, struct dlist_node *node)
+{
+	assert(self);
+	dlist_insert_next(self, self->head.prev, node);
+}
+
+void dlist_remove(struct dlist *self, struct dlist_node *node)
+{
+	assert(self);
+	assert(node);
+	assert(dlist_linked(node));
+
+	node->prev->next = node->next;
+	node->next->prev = node->prev;
+	node->prev = NULL;
+	node->next = NULL;
+	self->size--;
+}
+
+int dlist_linked(const struct dlist_node *node)
+{
+	assert(node);
+	return node->next != NULL;
+}
+
+struct dlist_node *dlist_head(struct dlist *self)
+{
+	assert(self);
+	return (self->head.next != &self->head) ? self->head.next : NULL;
+}
+
+struct dlist_node *dlist_last(struct dlist *self)
+{
+	assert(self);
+	return (self->head.prev != &self->head) ? self->head.prev : NULL;
+}
+
+struct dlist_node *dlist_next(struct dlist *self, struct dlist_node *current)
+{
+	assert(self);
+	assert(current);
+	return (current->next != &self->head) ? current->next : NULL;
+}
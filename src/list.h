@@ -9,11 +9,21 @@ struct node {
 	struct node *next;
 };
 
+/**
+ * Where a list gets its nodes and itself from, ctx is passed through
+ */
+struct list_allocator {
+	void *(*alloc)(size_t size, void *ctx);
+	void (*free)(void *ptr, void *ctx);
+	void *ctx;
+};
+
 struct list {
 	struct node *head;
 	struct node *last;
 	size_t size;
 	void (*dtor)(void *buf);
+	struct list_allocator allocator;
 };
 
 /**
@@ -23,6 +33,13 @@ struct list {
  */
 struct list *list_new(void (*dtor)(void *buf));
 
+/**
+ * Create a new, empty list whose nodes come from allocator, malloc and free if NULL
+ * 
+ * dtor: Specity a way to free the values
+ */
+struct list *list_new_with(void (*dtor)(void *buf), const struct list_allocator *allocator);
+
 /**
  * Free every value in a list, every node, and the list itself
  */
@@ -101,4 +118,83 @@ int list_iter_done(struct node **current);
 void *list_iter_value(struct node **current);
 struct node *list_iter_next(struct node **current);
 
+/**
+ * Intrusive doubly linked list: the node lives inside the value, so
+ * nothing is allocated and a node unlinks itself without a walk. The
+ * list is circular through its own head node
+ */
+struct dlist_node {
+	struct dlist_node *prev;
+	struct dlist_node *next; /* NULL while not in a list */
+};
+
+struct dlist {
+	struct dlist_node head;
+	size_t size;
+};
+
+/**
+ * The value of type TYPE whose member MEMBER is NODE
+ */
+#define DLIST_ENTRY(NODE, TYPE, MEMBER) \
+	((TYPE *)(void *)((char *)(NODE) - offsetof(TYPE, MEMBER)))
+
+/**
+ * Visit every TYPE *VAR in SELF through their member MEMBER, VAR may not be unlinked
+ */
+#define DLIST_FOREACH(VAR, SELF, TYPE, MEMBER) \
+	for ((VAR) = DLIST_ENTRY((SELF)->head.next, TYPE, MEMBER); \
+	     &(VAR)->MEMBER != &(SELF)->head; \
+	     (VAR) = DLIST_ENTRY((VAR)->MEMBER.next, TYPE, MEMBER))
+
+/**
+ * Like DLIST_FOREACH, but VAR may be unlinked, TMP holds the one after it
+ */
+#define DLIST_FOREACH_SAFE(VAR, TMP, SELF, TYPE, MEMBER) \
+	for ((VAR) = DLIST_ENTRY((SELF)->head.next, TYPE, MEMBER), \
+	     (TMP) = DLIST_ENTRY((VAR)->MEMBER.next, TYPE, MEMBER); \
+	     &(VAR)->MEMBER != &(SELF)->head; \
+	     (VAR) = (TMP), (TMP) = DLIST_ENTRY((VAR)->MEMBER.next, TYPE, MEMBER))
+
+/**
+ * Make an empty list
+ */
+void dlist_init(struct dlist *self);
+
+/**
+ * Link node after previous, which may be &self->head to make it the first
+ */
+void dlist_insert_next(struct dlist *self, struct dlist_node *previous, struct dlist_node *node);
+
+/**
+ * Link node first
+ */
+void dlist_push_front(struct dlist *self, struct dlist_node *node);
+
+/**
+ * Link node last
+ */
+void dlist_push_back(struct dlist *self, struct dlist_node *node);
+
+/**
+ * Unlink node, the value is the caller's
+ */
+void dlist_remove(struct dlist *self, struct dlist_node *node);
+
+/**
+ * Whether node is in a list
+ */
+int dlist_linked(const struct dlist_node *node);
+
+/**
+ * First and last node, NULL if empty
+ */
+struct dlist_node *dlist_head(struct dlist *self);
+struct dlist_node *dlist_last(struct dlist *self);
+
+/**
+ * The node after current, NULL at the end
+ */
+struct dlist_node *dlist_next(struct dlist *self, struct dlist_node *current);
+
 #endif /* JLIB_LIST_H */
@@ -15,7 +15,9 @@ int main(void)
 {
     struct flatdata me = { 0 };
     struct flatdata clients[MAX_CLIENTS] = { 0 };
+    const uint32_t *uids;
     char *p;
+    size_t n;
     int i;
 
     struct acs_sync *sync;
@@ -43,6 +45,16 @@ int main(void)
                 break;
 
             case ACS_SYNC_READ:
+                // who came and went since last time
+                n = acs_sync_read_joined(sync, &uids);
+                while (n-- > 0) {
+                    printf("Joined: %u\n", uids[n]);
+                }
+                n = acs_sync_read_left(sync, &uids);
+                while (n-- > 0) {
+                    printf("Left: %u\n", uids[n]);
+                }
+
                 // clear clients each iteration to fill with new data
                 memset(clients, 0, sizeof(clients));
                 i = 0;
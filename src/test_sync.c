@@ -0,0 +1,651 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#ifndef _WIN32
+    #include <signal.h>
+    #include <sys/types.h>
+    #include <sys/wait.h>
+    #include <unistd.h>
+#endif
+
+#include "acs_delta.h"
+#include "acs_schema.h"
+#include "acs_sync.h"
+
+/**
+ * Checks of the codecs, then against a server on 127.0.0.1:9999, run
+ * python src/acs_sync.py first. Run from the top of the repo, acs_sync.py
+ * checks its coders against ours too. Exits 0 when every check passes
+ */
+
+#define MAX_CLIENTS 16
+#define ROUNDS 20
+#define CHURN_PEERS 3     // sessions the churning process keeps up at once
+#define CHURN_ROUNDS 15   // round trips before it replaces one
+#define WARM_ROUNDS 100   // round trips before allocations must stop
+#define STEADY_ROUNDS 400 // round trips that must not allocate
+#define DELTA_CASES 300   // random frames coded against a changed copy
+#define DELTA_MAX 4096    // largest of those
+#define GUARD 64          // bytes past a decode's output that must stay as they were
+#define SCHEMA_CASES 1000 // random records packed and unpacked
+
+// reads C's codings from stdin as data,dict,coded in hex, one per line, or
+// just coded for one it must reject
+#define DELTA_PY \
+    "import struct, sys\n" \
+    "sys.path.insert(0, 'src')\n" \
+    "from acs_sync import delta_encode, delta_decode\n" \
+    "for n, line in enumerate(sys.stdin):\n" \
+    "    fields = [bytes.fromhex(x) for x in line.strip().split(',')]\n" \
+    "    if len(fields) == 1:\n" \
+    "        try:\n" \
+    "            delta_decode(fields[0], b'')\n" \
+    "        except (ValueError, struct.error):\n" \
+    "            continue\n" \
+    "        print('delta: acs_sync.py took bad case %d' % n)\n" \
+    "        sys.exit(1)\n" \
+    "    data, dict, coded = fields\n" \
+    "    if delta_encode(data, dict) != coded or delta_decode(coded, dict) != data:\n" \
+    "        print('delta: acs_sync.py differs on case %d' % n)\n" \
+    "        sys.exit(1)\n"
+
+struct flatdata {
+    uint32_t uid;
+    char data[32];
+};
+
+// one of each kind of field, see schema_fields
+struct schema_record {
+    uint32_t uid;
+    float x;
+    int16_t hp;
+    uint8_t flags;
+    uint32_t score;
+    char name[8];
+};
+
+static int rounds(struct acs_sync *sync, struct flatdata *me, int count, int write_last); // count READs, then stop at the next WRITE or do it
+static int check_group_del_run(int write_last); // a session runs on its own after its group is gone
+static unsigned rand_next(unsigned *state); // small LCG, the same cases every run
+static void hex_put(FILE *fp, const unsigned char *data, size_t size);
+static int delta_case(const unsigned char *data, size_t size, const unsigned char *dict, size_t dict_size, FILE *py); // code and decode one frame, 0 if it comes back
+static int delta_bad(const unsigned char *coded, size_t size, unsigned char *out, size_t out_size, FILE *py); // 0 if the decoder rejects it without writing past the raw size
+static int check_delta(void); // round trips, malformed input, and the same bytes as acs_sync.py
+static int schema_case(const struct schema_record *in); // pack and unpack, 0 if it comes back within a quantum
+static int check_schema(void); // quantized round trips, clamping, and change bits
+
+#ifndef _WIN32
+static void *count_malloc(size_t size, void *ctx);
+static void *count_realloc(void *ptr, size_t size, void *ctx);
+static void count_free(void *ptr, void *ctx);
+static void churn(void); // peers that join and leave for ever, in a process of its own
+static int check_steady_alloc(void); // no malloc or realloc once warmed up, with peers coming and going
+
+static volatile int counting = 0;
+static volatile unsigned long allocations = 0; // malloc and realloc calls while counting
+#endif
+
+static int rounds(struct acs_sync *sync, struct flatdata *me, int count, int write_last)
+{
+    uint64_t deadline = acs_time_us() + 5000000;
+    int done = 0;
+
+    while (acs_time_us() < deadline) {
+        switch (acs_sync_get_state(sync)) {
+        case ACS_SYNC_WRITE:
+            // the network thread holds the barrier until we write
+            if (done == count && !write_last) {
+                return 0;
+            }
+            (void)snprintf(me->data, sizeof(me->data), "round %d", done);
+            acs_sync_write(sync);
+            // the last upload goes out without waiting for its answer
+            if (done == count) {
+                return 0;
+            }
+            break;
+
+        case ACS_SYNC_READ:
+            while (acs_sync_read_next(sync)) {
+                ;
+            }
+            done++;
+            break;
+
+        default:
+            break;
+        }
+    }
+    return 1;
+}
+
+static int check_group_del_run(int write_last)
+{
+    struct flatdata me = { 0 };
+    struct acs_sync *sync;
+    struct acs_sync_group *group;
+
+    sync = acs_sync_new("127.0.0.1", "9999", MAX_CLIENTS, &me, sizeof(me));
+    group = acs_sync_group_new(1);
+    if (!sync || !group) {
+        printf("group_del then run: setup failed\n");
+        return 1;
+    }
+
+    acs_sync_group_add(group, sync);
+    if (acs_sync_group_run(group) || rounds(sync, &me, ROUNDS, write_last)) {
+        printf("group_del then run: grouped rounds failed\n");
+        return 1;
+    }
+    acs_sync_group_del(group);
+
+    // hangs here if the group left the barrier locked
+    if (acs_sync_run(sync) || rounds(sync, &me, ROUNDS, 0)) {
+        printf("group_del then run: own thread rounds failed\n");
+        return 1;
+    }
+    acs_sync_del(sync);
+
+    printf("group_del then run%s: ok\n", write_last ? " (write in flight)" : "");
+    return 0;
+}
+
+static unsigned rand_next(unsigned *state)
+{
+    *state = *state * 1103515245u + 12345u;
+    return (*state >> 16) & 0x7fff;
+}
+
+static void hex_put(FILE *fp, const unsigned char *data, size_t size)
+{
+    size_t i;
+
+    for (i = 0; i < size; i++) {
+        (void)fprintf(fp, "%02x", data[i]);
+    }
+}
+
+static int delta_case(const unsigned char *data, size_t size, const unsigned char *dict, size_t dict_size, FILE *py)
+{
+    unsigned char *coded;
+    unsigned char *out;
+    size_t coded_size;
+    size_t raw_size;
+    int rv = 0;
+
+    coded = malloc(ACS_DELTA_BOUND(size));
+    out = malloc(size + GUARD);
+    if (!coded || !out) {
+        free(coded);
+        free(out);
+        return 1;
+    }
+    (void)memset(out, 0xa5, size + GUARD);
+
+    coded_size = acs_delta_encode(data, size, dict, dict_size, coded);
+    if (coded_size > ACS_DELTA_BOUND(size)
+        || acs_delta_raw_size(coded, coded_size, &raw_size) != 0
+        || raw_size != size
+        || acs_delta_decode(coded, coded_size, dict, dict_size, out) != 0
+        || memcmp(out, data, size) != 0) {
+        rv = 1;
+    }
+    for (raw_size = size; raw_size < size + GUARD; raw_size++) {
+        if (out[raw_size] != 0xa5) {
+            rv = 1;
+        }
+    }
+
+    // every shorter coding runs out before the raw size
+    for (raw_size = 0; raw_size < coded_size && rv == 0; raw_size++) {
+        rv = delta_bad(coded, raw_size, out, size + GUARD, NULL);
+    }
+
+    if (py) {
+        hex_put(py, data, size);
+        (void)fputc(',', py);
+        hex_put(py, dict, dict_size);
+        (void)fputc(',', py);
+        hex_put(py, coded, coded_size);
+        (void)fputc('\n', py);
+    }
+
+    free(coded);
+    free(out);
+    return rv;
+}
+
+static int delta_bad(const unsigned char *coded, size_t size, unsigned char *out, size_t out_size, FILE *py)
+{
+    size_t raw_size = 0;
+    size_t i;
+
+    if (py) {
+        hex_put(py, coded, size);
+        (void)fputc('\n', py);
+    }
+
+    // out holds the raw size and GUARD more
+    if (acs_delta_raw_size(coded, size, &raw_size) == 0 && raw_size + GUARD > out_size) {
+        return 1;
+    }
+    (void)memset(out, 0xa5, out_size);
+    if (acs_delta_decode(coded, size, NULL, 0, out) == 0) {
+        return 1;
+    }
+    for (i = raw_size; i < out_size; i++) {
+        if (out[i] != 0xa5) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int check_delta(void)
+{
+    static const unsigned char trailing[] = { 4, 0, 0, 0, 4 << 1, 'a', 'b', 'c', 'd', 0 };
+    static const unsigned char long_run[] = { 4, 0, 0, 0, (100 << 1) | 1 };
+    static const unsigned char long_literal[] = { 8, 0, 0, 0, 8 << 1, 'a', 'b', 'c' };
+    static const unsigned char overlong[] = { 4, 0, 0, 0, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x01 };
+    static const unsigned char grown[] = { 5, 0, 0, 0, 4 << 1, 'a', 'b', 'c', 'd' };
+    static unsigned char data[DELTA_MAX];
+    static unsigned char dict[DELTA_MAX];
+    unsigned char out[16 + GUARD];
+    unsigned state = 1;
+    size_t size;
+    size_t dict_size;
+    size_t i;
+    FILE *py = NULL;
+    int failed = 0;
+    int n;
+
+    #ifndef _WIN32
+        // a python3 that stops at the first difference must not take us with it
+        (void)signal(SIGPIPE, SIG_IGN);
+        py = popen("python3 -c \"" DELTA_PY "\"", "w");
+        if (!py) {
+            printf("delta: python3 did not start\n");
+            failed = 1;
+        }
+    #endif
+
+    // nothing, and nothing against a dictionary
+    (void)memset(dict, 'x', 64);
+    failed |= delta_case(data, 0, NULL, 0, py);
+    failed |= delta_case(data, 0, dict, 64, py);
+
+    // no dictionary reads as zeros, so zero runs are copied from it
+    (void)memset(data, 0, sizeof(data));
+    (void)memcpy(&data[100], "a few bytes", 11);
+    failed |= delta_case(data, 3000, NULL, 0, py);
+    failed |= delta_case(data, sizeof(data), NULL, 0, py);
+
+    // the same frame again, and one grown or shrunk against it
+    (void)memcpy(dict, data, sizeof(data));
+    failed |= delta_case(data, 3000, dict, 3000, py);
+    data[2999] = 'z';
+    failed |= delta_case(data, 3500, dict, 3000, py);
+    failed |= delta_case(data, 1000, dict, 3000, py);
+
+    // equal runs just under, at and over ACS_DELTA_MIN_RUN, each ended by a change
+    for (i = 0, n = 0; i < 256; n++) {
+        size = ACS_DELTA_MIN_RUN - 1 + n % 3;
+        for (; size > 0 && i < 256; size--, i++) {
+            data[i] = (unsigned char)i;
+            dict[i] = (unsigned char)i;
+        }
+        if (i < 256) {
+            data[i] = (unsigned char)i;
+            dict[i] = (unsigned char)~i;
+            i++;
+        }
+    }
+    failed |= delta_case(data, 256, dict, 256, py);
+
+    for (n = 0; n < DELTA_CASES; n++) {
+        size = rand_next(&state) % DELTA_MAX;
+        dict_size = (n % 4 == 0) ? 0 : rand_next(&state) % DELTA_MAX;
+        for (i = 0; i < dict_size; i++) {
+            dict[i] = (unsigned char)((n % 3 == 0) ? 0 : rand_next(&state));
+        }
+        // mostly the dictionary, with changes scattered thru it
+        for (i = 0; i < size; i++) {
+            data[i] = (i < dict_size) ? dict[i] : 0;
+            if (rand_next(&state) % 64 == 0) {
+                data[i] = (unsigned char)rand_next(&state);
+            }
+        }
+        failed |= delta_case(data, size, dict, dict_size, py);
+    }
+
+    failed |= delta_bad(long_run, sizeof(long_run), out, sizeof(out), py);
+    failed |= delta_bad(long_literal, sizeof(long_literal), out, sizeof(out), py);
+    failed |= delta_bad(overlong, sizeof(overlong), out, sizeof(out), py);
+    failed |= delta_bad(grown, sizeof(grown), out, sizeof(out), py);
+    failed |= delta_bad(trailing, sizeof(trailing), out, sizeof(out), py);
+
+    if (failed) {
+        printf("delta: a frame did not come back, or bad input was taken\n");
+    }
+
+    #ifndef _WIN32
+        if (py && pclose(py) != 0) {
+            failed = 1;
+        }
+    #endif
+
+    if (!failed) {
+        printf("delta: ok\n");
+    }
+    return failed;
+}
+
+static const struct acs_sync_field schema_fields[] = {
+    { offsetof(struct schema_record, x), ACS_SYNC_F32, 12, -100.0f, 100.0f, 0 },
+    { offsetof(struct schema_record, hp), ACS_SYNC_I16, 10, -100.0f, 0.0f, 0 },
+    { offsetof(struct schema_record, flags), ACS_SYNC_U8, 3, 0.0f, 0.0f, 0 },
+    { offsetof(struct schema_record, score), ACS_SYNC_U32, 32, 0.0f, 0.0f, 0 },
+    { offsetof(struct schema_record, name), ACS_SYNC_BYTES, 0, 0.0f, 0.0f, 8 },
+};
+
+#define SCHEMA_COUNT (sizeof(schema_fields) / sizeof(schema_fields[0]))
+#define SCHEMA_QUANTUM (200.0f / 4095.0f) // of x
+
+static int schema_case(const struct schema_record *in)
+{
+    unsigned char coded[64];
+    struct schema_record out;
+    struct schema_record want;
+    size_t coded_size;
+    size_t used;
+
+    // what the fields clamp to
+    want = *in;
+    if (!(want.x > -100.0f)) {
+        want.x = -100.0f;
+    }
+    else if (want.x > 100.0f) {
+        want.x = 100.0f;
+    }
+    want.hp = (int16_t)((want.hp < -100) ? -100 : (want.hp > 923) ? 923 : want.hp);
+    want.flags = (uint8_t)((want.flags > 7) ? 7 : want.flags);
+
+    // every field goes without a reference, the uid is left as it is
+    (void)memset(&out, 0x5a, sizeof(out));
+    coded_size = acs_schema_encode(schema_fields, SCHEMA_COUNT, in, NULL, coded);
+    if (coded_size != acs_schema_bound(schema_fields, SCHEMA_COUNT)
+        || acs_schema_decode(schema_fields, SCHEMA_COUNT, coded, coded_size, &out, &used) != 0
+        || used != coded_size
+        || out.uid != 0x5a5a5a5a
+        || fabsf(out.x - want.x) > SCHEMA_QUANTUM
+        || out.hp != want.hp
+        || out.flags != want.flags
+        || out.score != want.score
+        || memcmp(out.name, want.name, sizeof(out.name)) != 0) {
+        return 1;
+    }
+
+    // a byte short runs past the record
+    if (acs_schema_decode(schema_fields, SCHEMA_COUNT, coded, coded_size - 1, &out, &used) == 0) {
+        return 1;
+    }
+
+    // against itself, only the change bits
+    coded_size = acs_schema_encode(schema_fields, SCHEMA_COUNT, in, in, coded);
+    if (coded_size != (SCHEMA_COUNT + 7) / 8 || coded[0] != 0) {
+        return 1;
+    }
+    return 0;
+}
+
+static int check_schema(void)
+{
+    static const float edges[] = { -100.0f, 100.0f, -100.5f, 100.5f, -1e30f, 1e30f, 0.0f };
+    struct schema_record in = { 0 };
+    struct schema_record ref;
+    struct schema_record out;
+    unsigned char coded[64];
+    unsigned state = 7;
+    size_t coded_size;
+    size_t used;
+    size_t i;
+    int failed = 0;
+    int n;
+
+    if (acs_schema_check(schema_fields, SCHEMA_COUNT, sizeof(struct schema_record)) != 0) {
+        printf("schema: the check's own schema is refused\n");
+        return 1;
+    }
+
+    // on and past both ends of every range, and NaN which lands on min
+    for (i = 0; i < sizeof(edges) / sizeof(edges[0]); i++) {
+        in.x = edges[i];
+        in.hp = (int16_t)((i % 2) ? 32767 : -32768);
+        in.flags = (uint8_t)((i % 2) ? 255 : 0);
+        in.score = (i % 2) ? 0xffffffffu : 0;
+        failed |= schema_case(&in);
+    }
+    in.x = (float)NAN;
+    failed |= schema_case(&in);
+
+    for (n = 0; n < SCHEMA_CASES; n++) {
+        in.uid = (uint32_t)n;
+        in.x = (float)rand_next(&state) / 32767.0f * 240.0f - 120.0f;
+        in.hp = (int16_t)(rand_next(&state) % 1200 - 200);
+        in.flags = (uint8_t)(rand_next(&state) % 12);
+        in.score = (uint32_t)rand_next(&state) << 17 ^ rand_next(&state);
+        for (i = 0; i < sizeof(in.name); i++) {
+            in.name[i] = (char)rand_next(&state);
+        }
+        failed |= schema_case(&in);
+    }
+
+    // one changed field costs its change bit and its own bits, the rest stay as the receiver has them
+    ref = in;
+    in.hp = (int16_t)(ref.hp + 1);
+    coded_size = acs_schema_encode(schema_fields, SCHEMA_COUNT, &in, &ref, coded);
+    out = ref;
+    if (coded_size != (SCHEMA_COUNT + 10 + 7) / 8
+        || acs_schema_decode(schema_fields, SCHEMA_COUNT, coded, coded_size, &out, &used) != 0
+        || used != coded_size
+        || out.hp != in.hp
+        || out.x != ref.x
+        || out.flags != ref.flags
+        || out.score != ref.score
+        || memcmp(out.name, ref.name, sizeof(out.name)) != 0) {
+        failed = 1;
+    }
+
+    // a change within the quantum is no change
+    in = ref;
+    in.x = ref.x + SCHEMA_QUANTUM / 16.0f;
+    if (acs_schema_encode(schema_fields, SCHEMA_COUNT, &in, &ref, coded) != (SCHEMA_COUNT + 7) / 8) {
+        in.x = ref.x - SCHEMA_QUANTUM / 16.0f;
+        if (acs_schema_encode(schema_fields, SCHEMA_COUNT, &in, &ref, coded) != (SCHEMA_COUNT + 7) / 8) {
+            failed = 1;
+        }
+    }
+
+    if (failed) {
+        printf("schema: a record did not come back within a quantum, or cost more than its changes\n");
+    }
+    else {
+        printf("schema: ok\n");
+    }
+    return failed;
+}
+
+#ifndef _WIN32
+
+static void *count_malloc(size_t size, void *ctx)
+{
+    (void)ctx;
+    if (counting) {
+        allocations++;
+    }
+    return malloc(size);
+}
+
+static void *count_realloc(void *ptr, size_t size, void *ctx)
+{
+    (void)ctx;
+    if (counting) {
+        allocations++;
+    }
+    return realloc(ptr, size);
+}
+
+static void count_free(void *ptr, void *ctx)
+{
+    (void)ctx;
+    free(ptr);
+}
+
+static void churn(void)
+{
+    struct flatdata peers[CHURN_PEERS] = { { 0 } };
+    struct acs_sync *syncs[CHURN_PEERS];
+    int reads[CHURN_PEERS];
+    int i;
+
+    acs_sync_init();
+
+    // staggered, so one of them leaves or joins every few round trips
+    for (i = 0; i < CHURN_PEERS; i++) {
+        syncs[i] = acs_sync_new("127.0.0.1", "9999", MAX_CLIENTS, &peers[i], sizeof(peers[i]));
+        (void)acs_sync_run(syncs[i]);
+        reads[i] = i * CHURN_ROUNDS / CHURN_PEERS;
+    }
+
+    // until the parent kills us
+    while (1) {
+        for (i = 0; i < CHURN_PEERS; i++) {
+            switch (acs_sync_get_state(syncs[i])) {
+            case ACS_SYNC_WRITE:
+                acs_sync_write(syncs[i]);
+                break;
+
+            case ACS_SYNC_READ:
+                while (acs_sync_read_next(syncs[i])) {
+                    ;
+                }
+                if (++reads[i] < CHURN_ROUNDS) {
+                    break;
+                }
+                acs_sync_del(syncs[i]);
+                (void)memset(&peers[i], 0, sizeof(peers[i]));
+                syncs[i] = acs_sync_new("127.0.0.1", "9999", MAX_CLIENTS, &peers[i], sizeof(peers[i]));
+                (void)acs_sync_run(syncs[i]);
+                reads[i] = 0;
+                break;
+
+            default:
+                break;
+            }
+        }
+    }
+}
+
+static int check_steady_alloc(void)
+{
+    struct acs_allocator allocator = { count_malloc, count_realloc, count_free, NULL };
+    struct flatdata me = { 0 };
+    struct acs_sync *sync;
+    const uint32_t *uids;
+    uint64_t deadline;
+    size_t joined = 0;
+    size_t left = 0;
+    pid_t pid;
+    int done = 0;
+
+    // before acs_sync_init, so the child starts with no threads of ours
+    pid = fork();
+    if (pid < 0) {
+        printf("steady alloc: fork failed\n");
+        return 1;
+    }
+    if (pid == 0) {
+        churn();
+        _exit(0);
+    }
+
+    acs_set_allocator(&allocator);
+    acs_sync_init();
+
+    sync = acs_sync_new("127.0.0.1", "9999", MAX_CLIENTS, &me, sizeof(me));
+    (void)acs_sync_run(sync);
+
+    deadline = acs_time_us() + 30000000;
+    while (done < WARM_ROUNDS + STEADY_ROUNDS && acs_time_us() < deadline) {
+        switch (acs_sync_get_state(sync)) {
+        case ACS_SYNC_WRITE:
+            (void)snprintf(me.data, sizeof(me.data), "round %d", done);
+            acs_sync_write(sync);
+            break;
+
+        case ACS_SYNC_READ:
+            if (done >= WARM_ROUNDS) {
+                joined += acs_sync_read_joined(sync, &uids);
+                left += acs_sync_read_left(sync, &uids);
+            }
+            while (acs_sync_read_next(sync)) {
+                ;
+            }
+            // the network thread waits on us now, so it counts from its next round trip
+            counting = (++done >= WARM_ROUNDS);
+            break;
+
+        default:
+            break;
+        }
+    }
+    counting = 0;
+
+    acs_sync_del(sync);
+    acs_sync_cleanup();
+    acs_set_allocator(NULL);
+
+    (void)kill(pid, SIGKILL);
+    (void)waitpid(pid, NULL, 0);
+
+    if (done < WARM_ROUNDS + STEADY_ROUNDS || joined == 0 || left == 0) {
+        printf("steady alloc: %d round trips, %lu joined, %lu left\n", done, (unsigned long)joined, (unsigned long)left);
+        return 1;
+    }
+    if (allocations != 0) {
+        printf("steady alloc: %lu allocations over %d round trips\n", allocations, STEADY_ROUNDS);
+        return 1;
+    }
+
+    printf("steady alloc: ok, %lu joined and %lu left\n", (unsigned long)joined, (unsigned long)left);
+    return 0;
+}
+
+#endif
+
+int main(void)
+{
+    int failed = 0;
+
+    failed |= check_delta();
+    failed |= check_schema();
+
+    acs_sync_init();
+
+    failed |= check_group_del_run(0);
+    failed |= check_group_del_run(1);
+
+    acs_sync_cleanup();
+
+    #ifndef _WIN32
+        failed |= check_steady_alloc();
+    #endif
+
+    return failed;
+}